@@ -0,0 +1,407 @@
+/* Short description: bounding volume hierarchy over mesh polygons and
+ * view frustum, used to skip parts of mesh which are out of view
+ */
+
+#include "Bvh.h"
+#include "Profiler.h"
+#include "VertexCache.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <memory>
+
+frustum frustum::fromMatrix(const mat4x4& m) {
+	// clip = (x, y, z, 1) * m, so column j of m gives clip coordinate j
+	// inside means -w <= x <= w, -w <= y <= w, 0 <= z <= w
+	frustum f;
+	for (int r = 0; r < 4; r++) {
+		f.planes[0][r] = m.m[r][3] + m.m[r][0];
+		f.planes[1][r] = m.m[r][3] - m.m[r][0];
+		f.planes[2][r] = m.m[r][3] + m.m[r][1];
+		f.planes[3][r] = m.m[r][3] - m.m[r][1];
+		f.planes[4][r] = m.m[r][2];
+		f.planes[5][r] = m.m[r][3] - m.m[r][2];
+	}
+	return f;
+}
+
+int frustum::classifyBox(const float boundsMin[3], const float boundsMax[3]) const {
+	bool inside = true;
+	for (int p = 0; p < 6; p++) {
+		const float* plane = planes[p];
+
+		// box corners farthest along and against plane normal
+		float farthest = plane[3], nearest = plane[3];
+		for (int a = 0; a < 3; a++) {
+			if (plane[a] >= 0.0f) {
+				farthest += plane[a] * boundsMax[a];
+				nearest += plane[a] * boundsMin[a];
+			}
+			else {
+				farthest += plane[a] * boundsMin[a];
+				nearest += plane[a] * boundsMax[a];
+			}
+		}
+		if (farthest < 0.0f) return -1;
+		if (nearest < 0.0f) inside = false;
+	}
+	return inside ? 1 : 0;
+}
+
+// leaves reordered one after another with cache state carried over, runs are
+// independent of each other and go to different threads
+static const size_t leafRun = 64;
+
+// FIFO vertex cache as vertexCacheMissRatio counts it, over mesh vertex indices
+class fifoVertexCache
+{
+public:
+	unsigned int entries[vertexCacheSize];
+	size_t used = 0;
+	size_t next = 0;		// entry the next miss replaces
+
+	// load vertices of polygons in order, returns number of misses
+	size_t draw(const unsigned int* indices, size_t count) {
+		size_t misses = 0;
+		for (size_t i = 0; i < count; i++) {
+			unsigned int v = indices[i];
+			if (std::find(entries, entries + used, v) != entries + used) {
+				continue;
+			}
+			entries[next] = v;
+			next = (next + 1) % vertexCacheSize;
+			used = std::min(used + 1, vertexCacheSize);
+			misses++;
+		}
+		return misses;
+	}
+
+	// cached vertices, most recently loaded first
+	size_t recent(unsigned int* out) const {
+		for (size_t i = 0; i < used; i++) {
+			out[i] = entries[(next + vertexCacheSize - 1 - i) % vertexCacheSize];
+		}
+		return used;
+	}
+};
+
+// sort ranges and join overlapping ones, vertex ranges of leaves may overlap
+static void mergeRanges(std::vector<meshRange>& ranges) {
+	std::sort(ranges.begin(), ranges.end(), [](const meshRange& a, const meshRange& b) { return a.first < b.first; });
+	size_t nMerged = 0;
+	for (size_t i = 0; i < ranges.size(); i++) {
+		if (nMerged > 0 && ranges[i].first <= ranges[nMerged - 1].last) {
+			ranges[nMerged - 1].last = std::max(ranges[nMerged - 1].last, ranges[i].last);
+		}
+		else {
+			ranges[nMerged++] = ranges[i];
+		}
+	}
+	ranges.resize(nMerged);
+}
+
+void bvh::build(mesh& m) {
+	PROFILE_ZONE("build bvh");
+	nodes.clear();
+	size_t nPolys = m.polyCount();
+	if (nPolys == 0) {
+		return;
+	}
+
+	acmrFile = vertexCacheMissRatio(m.indices.data(), nPolys, m.verts.size());
+
+	// polygon centroids, split decisions are made on them
+	std::vector<float> centroids(nPolys * 3);
+	std::vector<unsigned int> order(nPolys);
+	for (size_t i = 0; i < nPolys; i++) {
+		const unsigned int* idx = &m.indices[i * 3];
+		centroids[i * 3 + 0] = (m.verts.x[idx[0]] + m.verts.x[idx[1]] + m.verts.x[idx[2]]) / 3.0f;
+		centroids[i * 3 + 1] = (m.verts.y[idx[0]] + m.verts.y[idx[1]] + m.verts.y[idx[2]]) / 3.0f;
+		centroids[i * 3 + 2] = (m.verts.z[idx[0]] + m.verts.z[idx[1]] + m.verts.z[idx[2]]) / 3.0f;
+		order[i] = (unsigned int)i;
+	}
+
+	nodes.reserve(2 * (nPolys / std::max(1u, leafSize) + 1));
+	buildNode(m, order, centroids, 0, (unsigned int)nPolys);
+
+	// store polygons in leaf order
+	std::vector<unsigned int> indices(m.indices.size());
+	for (size_t i = 0; i < nPolys; i++) {
+		indices[i * 3 + 0] = m.indices[order[i] * 3 + 0];
+		indices[i * 3 + 1] = m.indices[order[i] * 3 + 1];
+		indices[i * 3 + 2] = m.indices[order[i] * 3 + 2];
+	}
+
+	// polygons inside of every leaf are ordered for vertex reuse, leaf ranges stay the same
+	acmrBefore = vertexCacheMissRatio(indices.data(), nPolys, m.verts.size());
+	if (vertexCacheOrder) {
+		reorderLeaves(indices, m.verts.size());
+	}
+
+	// renumber vertices in order of first use, unused ones go to the end
+	const unsigned int unused = 0xFFFFFFFF;
+	size_t nVerts = m.verts.size();
+	std::vector<unsigned int> remap(nVerts, unused);
+	unsigned int nextVert = 0;
+	for (unsigned int& i : indices) {
+		if (remap[i] == unused) remap[i] = nextVert++;
+		i = remap[i];
+	}
+	for (size_t v = 0; v < nVerts; v++) {
+		if (remap[v] == unused) remap[v] = nextVert++;
+	}
+	vertexStream verts;
+	verts.resize(nVerts);
+	for (size_t v = 0; v < nVerts; v++) {
+		verts.x[remap[v]] = m.verts.x[v];
+		verts.y[remap[v]] = m.verts.y[v];
+		verts.z[remap[v]] = m.verts.z[v];
+	}
+	m.verts = std::move(verts);
+	if (m.normals.size() == nVerts) {
+		vertexStream normals;
+		normals.resize(nVerts);
+		for (size_t v = 0; v < nVerts; v++) {
+			normals.x[remap[v]] = m.normals.x[v];
+			normals.y[remap[v]] = m.normals.y[v];
+			normals.z[remap[v]] = m.normals.z[v];
+		}
+		m.normals = std::move(normals);
+	}
+	m.indices = std::move(indices);
+	acmrAfter = vertexCacheMissRatio(m.indices.data(), nPolys, m.verts.size());
+
+	computeVertRanges(m, 0);
+}
+
+void bvh::reorderLeaves(std::vector<unsigned int>& indices, size_t nVerts) const {
+	PROFILE_ZONE("vertex cache order");
+	std::vector<unsigned int> leaves;
+	for (size_t n = 0; n < nodes.size(); n++) {
+		if (nodes[n].left < 0) leaves.push_back((unsigned int)n);
+	}
+
+	// runs of leaves are independent, large meshes split them between threads
+	size_t runs = (leaves.size() + leafRun - 1) / leafRun;
+	std::unique_ptr<ThreadPool> pool;
+	if (leaves.size() >= parallelLeaves) {
+		pool.reset(new ThreadPool());
+	}
+	int workers = pool ? pool->size() : 1;
+
+	// leaf vertices are numbered from 0 for the optimizer
+	const unsigned int unused = 0xFFFFFFFF;
+	std::vector<std::vector<unsigned int>> local(workers, std::vector<unsigned int>(nVerts, unused));
+	auto reorderRun = [&](size_t run, int worker) {
+		std::vector<unsigned int>& toLocal = local[worker];
+		std::vector<unsigned int> global;
+		std::vector<unsigned int> leafIndices;
+		fifoVertexCache cache;
+		size_t lastLeaf = std::min((run + 1) * leafRun, leaves.size());
+		for (size_t l = run * leafRun; l < lastLeaf; l++) {
+			const bvhNode& node = nodes[leaves[l]];
+			unsigned int* incoming = &indices[node.polys.first * 3];
+			size_t nIndices = (node.polys.last - node.polys.first) * 3;
+
+			global.clear();
+			leafIndices.assign(incoming, incoming + nIndices);
+			for (unsigned int& i : leafIndices) {
+				if (toLocal[i] == unused) {
+					toLocal[i] = (unsigned int)global.size();
+					global.push_back(i);
+				}
+				i = toLocal[i];
+			}
+
+			// optimizer starts with vertices the previous leaf left in cache
+			unsigned int recent[vertexCacheSize];
+			size_t nRecent = 0;
+			unsigned int cached[vertexCacheSize];
+			size_t nCached = cache.recent(recent);
+			for (size_t k = 0; k < nCached; k++) {
+				if (toLocal[recent[k]] != unused) cached[nRecent++] = toLocal[recent[k]];
+			}
+			optimizeVertexCache(leafIndices.data(), node.polys.last - node.polys.first, global.size(), cached, nRecent);
+			for (unsigned int& i : leafIndices) {
+				i = global[i];
+			}
+			for (unsigned int v : global) {
+				toLocal[v] = unused;
+			}
+
+			// incoming order stays if reordering does not lower misses
+			fifoVertexCache keptCache = cache;
+			size_t keptMisses = keptCache.draw(incoming, nIndices);
+			size_t reorderedMisses = cache.draw(leafIndices.data(), nIndices);
+			if (reorderedMisses < keptMisses) {
+				std::copy(leafIndices.begin(), leafIndices.end(), incoming);
+			}
+			else {
+				cache = keptCache;
+			}
+		}
+	};
+
+	if (pool) {
+		pool->parallelFor(runs, reorderRun);
+	}
+	else {
+		for (size_t r = 0; r < runs; r++) reorderRun(r, 0);
+	}
+}
+
+void bvh::inflate(const float margin[3]) {
+	for (bvhNode& node : nodes) {
+		for (int c = 0; c < 3; c++) {
+			node.boundsMin[c] -= margin[c];
+			node.boundsMax[c] += margin[c];
+		}
+	}
+}
+
+int bvh::buildNode(const mesh& m, std::vector<unsigned int>& order, const std::vector<float>& centroids, unsigned int first, unsigned int last) {
+	int nodeIndex = (int)nodes.size();
+	nodes.emplace_back();
+
+	// bounds of polygons and of their centroids
+	float bMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, bMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	float cMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, cMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	const float* coords[3] = { m.verts.x.data(), m.verts.y.data(), m.verts.z.data() };
+	for (unsigned int i = first; i < last; i++) {
+		const unsigned int* idx = &m.indices[order[i] * 3];
+		for (int a = 0; a < 3; a++) {
+			for (int k = 0; k < 3; k++) {
+				bMin[a] = std::min(bMin[a], coords[a][idx[k]]);
+				bMax[a] = std::max(bMax[a], coords[a][idx[k]]);
+			}
+			cMin[a] = std::min(cMin[a], centroids[order[i] * 3 + a]);
+			cMax[a] = std::max(cMax[a], centroids[order[i] * 3 + a]);
+		}
+	}
+	for (int a = 0; a < 3; a++) {
+		nodes[nodeIndex].boundsMin[a] = bMin[a];
+		nodes[nodeIndex].boundsMax[a] = bMax[a];
+	}
+	nodes[nodeIndex].polys.first = first;
+	nodes[nodeIndex].polys.last = last;
+
+	// split at median of the longest centroid axis
+	int axis = 0;
+	for (int a = 1; a < 3; a++) {
+		if (cMax[a] - cMin[a] > cMax[axis] - cMin[axis]) axis = a;
+	}
+	if (last - first <= leafSize || !(cMax[axis] > cMin[axis])) {
+		// polygons of leaf keep their order of the source, which usually already reuses vertices
+		std::sort(order.begin() + first, order.begin() + last);
+		return nodeIndex;
+	}
+
+	unsigned int mid = first + (last - first) / 2;
+	std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + last,
+		[&](unsigned int a, unsigned int b) { return centroids[a * 3 + axis] < centroids[b * 3 + axis]; });
+
+	int left = buildNode(m, order, centroids, first, mid);
+	int right = buildNode(m, order, centroids, mid, last);
+	nodes[nodeIndex].left = left;
+	nodes[nodeIndex].right = right;
+	return nodeIndex;
+}
+
+void bvh::computeVertRanges(const mesh& m, int node) {
+	bvhNode& n = nodes[node];
+	if (n.left < 0) {
+		unsigned int vMin = 0xFFFFFFFF, vMax = 0;
+		for (unsigned int i = n.polys.first * 3; i < n.polys.last * 3; i++) {
+			vMin = std::min(vMin, m.indices[i]);
+			vMax = std::max(vMax, m.indices[i]);
+		}
+		n.verts.first = vMin;
+		n.verts.last = vMax + 1;
+		return;
+	}
+
+	computeVertRanges(m, n.left);
+	computeVertRanges(m, n.right);
+	bvhNode& l = nodes[n.left];
+	bvhNode& r = nodes[n.right];
+	n.verts.first = std::min(l.verts.first, r.verts.first);
+	n.verts.last = std::max(l.verts.last, r.verts.last);
+}
+
+void bvh::cull(const frustum& view, std::vector<meshRange>& polyRanges, std::vector<meshRange>& vertRanges) const {
+	polyRanges.clear();
+	vertRanges.clear();
+	if (nodes.empty()) {
+		return;
+	}
+	cullNode(0, view, false, polyRanges, vertRanges);
+	mergeRanges(vertRanges);
+}
+
+void bvh::cullNode(int node, const frustum& view, bool inside, std::vector<meshRange>& polyRanges, std::vector<meshRange>& vertRanges) const {
+	const bvhNode& n = nodes[node];
+
+	// children of a node fully inside do not need the test
+	if (!inside) {
+		int result = view.classifyBox(n.boundsMin, n.boundsMax);
+		if (result < 0) return;
+		inside = result > 0;
+	}
+
+	if (n.left < 0 || inside) {
+		// join with previous range when they touch
+		if (!polyRanges.empty() && polyRanges.back().last == n.polys.first) {
+			polyRanges.back().last = n.polys.last;
+		}
+		else {
+			polyRanges.push_back(n.polys);
+		}
+		vertRanges.push_back(n.verts);
+		return;
+	}
+
+	cullNode(n.left, view, inside, polyRanges, vertRanges);
+	cullNode(n.right, view, inside, polyRanges, vertRanges);
+}
+
+void bvh::cullLeaves(const frustum& view, std::vector<unsigned int>& leaves) const {
+	leaves.clear();
+	if (nodes.empty()) {
+		return;
+	}
+	cullLeafNode(0, view, false, leaves);
+}
+
+void bvh::cullLeafNode(int node, const frustum& view, bool inside, std::vector<unsigned int>& leaves) const {
+	const bvhNode& n = nodes[node];
+	if (!inside) {
+		int result = view.classifyBox(n.boundsMin, n.boundsMax);
+		if (result < 0) return;
+		inside = result > 0;
+	}
+
+	if (n.left < 0) {
+		leaves.push_back((unsigned int)node);
+		return;
+	}
+	cullLeafNode(n.left, view, inside, leaves);
+	cullLeafNode(n.right, view, inside, leaves);
+}
+
+void bvh::leafRanges(const unsigned int* leaves, size_t count, std::vector<meshRange>& polyRanges, std::vector<meshRange>& vertRanges) const {
+	polyRanges.clear();
+	vertRanges.clear();
+	for (size_t i = 0; i < count; i++) {
+		const bvhNode& n = nodes[leaves[i]];
+		if (!polyRanges.empty() && polyRanges.back().last == n.polys.first) {
+			polyRanges.back().last = n.polys.last;
+		}
+		else {
+			polyRanges.push_back(n.polys);
+		}
+		vertRanges.push_back(n.verts);
+	}
+	mergeRanges(vertRanges);
+}
@@ -0,0 +1,81 @@
+/* Short description: bounding volume hierarchy over mesh polygons and
+ * view frustum, used to skip parts of mesh which are out of view
+ */
+
+#pragma once
+
+#include "Util.h"
+
+#include <vector>
+
+// half open range [first, last) of polygons or vertices
+class meshRange
+{
+public:
+	unsigned int first = 0;
+	unsigned int last = 0;
+};
+
+// 6 planes of view frustum, points inside have a * x + b * y + c * z + d >= 0
+class frustum
+{
+public:
+	float planes[6][4];
+
+	// planes of object -> clip space transform (world * view * projection)
+	static frustum fromMatrix(const mat4x4& matObjectToClip);
+
+	// -1 - box is outside, 0 - intersects, 1 - fully inside
+	int classifyBox(const float boundsMin[3], const float boundsMax[3]) const;
+};
+
+class bvhNode
+{
+public:
+	float boundsMin[3];
+	float boundsMax[3];
+	meshRange polys;			// polygons under the node, contiguous in index buffer
+	meshRange verts;			// range covering all vertices used by those polygons
+	int left = -1;				// children, -1 for leaf
+	int right = -1;
+};
+
+class bvh
+{
+public:
+	std::vector<bvhNode> nodes;	// root is the first node, empty if not built
+	unsigned int leafSize = 256;	// maximum polygons per leaf
+	bool vertexCacheOrder = true;	// reorder polygons inside of leaves for vertex reuse
+	size_t parallelLeaves = 256;	// leaves needed to reorder them on multiple threads
+	float acmrFile = 0.0f;			// average vertex cache miss ratio of polygons as build() gets them, in file order for level 0
+	float acmrBefore = 0.0f;		// average vertex cache miss ratio of polygons in leaf order, as reordering gets them
+	float acmrAfter = 0.0f;			// and after reordering
+
+	// build hierarchy over mesh, reorders polygons of mesh so every node covers
+	// a contiguous range of them, polygons of leaves in source order or in vertex
+	// cache order where that has fewer misses, and
+	// renumbers vertices in order of first use so nearby polygons also share
+	// a small range of vertices
+	void build(mesh& m);
+
+	// grow bounds of all nodes by margin on every axis, so they still hold
+	// vertices which have been moved by up to margin
+	void inflate(const float margin[3]);
+
+	// collect polygon and vertex ranges of nodes which are at least partially
+	// inside the frustum, ranges are sorted and do not overlap
+	void cull(const frustum& view, std::vector<meshRange>& polyRanges, std::vector<meshRange>& vertRanges) const;
+
+	// collect leaves which are at least partially inside the frustum, in order of their polygons
+	void cullLeaves(const frustum& view, std::vector<unsigned int>& leaves) const;
+
+	// polygon and vertex ranges of leaves given in order of their polygons, in the same form as cull gives
+	void leafRanges(const unsigned int* leaves, size_t count, std::vector<meshRange>& polyRanges, std::vector<meshRange>& vertRanges) const;
+
+private:
+	int buildNode(const mesh& m, std::vector<unsigned int>& order, const std::vector<float>& centroids, unsigned int first, unsigned int last);
+	void computeVertRanges(const mesh& m, int node);
+	void reorderLeaves(std::vector<unsigned int>& indices, size_t nVerts) const;
+	void cullNode(int node, const frustum& view, bool inside, std::vector<meshRange>& polyRanges, std::vector<meshRange>& vertRanges) const;
+	void cullLeafNode(int node, const frustum& view, bool inside, std::vector<unsigned int>& leaves) const;
+};
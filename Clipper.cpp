@@ -0,0 +1,77 @@
+/* Short description: polygon clipping in homogeneous clip space,
+ * works on fixed size buffers without any allocations
+ */
+
+#include "Clipper.h"
+
+#include <utility>
+
+// signed distance to one of the clip planes, inside is >= 0
+static inline float planeDistance(const vec4& v, int plane, float guardBand) {
+	switch (plane)
+	{
+	case 0:		return v.z;							// near: z >= 0
+	case 1:		return v.w - v.z;					// far: z <= w
+	case 2:		return guardBand * v.w + v.x;		// x >= -g * w
+	case 3:		return guardBand * v.w - v.x;		// x <= g * w
+	case 4:		return guardBand * v.w + v.y;		// y >= -g * w
+	default:	return guardBand * v.w - v.y;		// y <= g * w
+	}
+}
+
+// point between a and b, interpolates all 4 components
+static inline vec4 lerp(const vec4& a, const vec4& b, float t) {
+	return vec4(a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t);
+}
+
+int clipTriangle(const vec4 in[3], unsigned int planeMask, float guardBand, vec4 out[maxClippedVerts]) {
+	// clip flags that belong to each plane
+	const unsigned int planeFlags[6] = { CLIP_NEAR, CLIP_FAR, CLIP_GUARD_X, CLIP_GUARD_X, CLIP_GUARD_Y, CLIP_GUARD_Y };
+
+	// two buffers are swapped after every plane
+	vec4 buffer[2][maxClippedVerts];
+	vec4* src = buffer[0];
+	vec4* dst = buffer[1];
+	int nSrc = 3;
+	src[0] = in[0];
+	src[1] = in[1];
+	src[2] = in[2];
+
+	for (int plane = 0; plane < 6; plane++) {
+		if (!(planeMask & planeFlags[plane])) {
+			continue;
+		}
+
+		// Sutherland-Hodgman: keep inside points, add intersections on crossing edges
+		int nDst = 0;
+		float dPrev = planeDistance(src[nSrc - 1], plane, guardBand);
+		for (int i = 0; i < nSrc; i++) {
+			const vec4& prev = src[(i + nSrc - 1) % nSrc];
+			const vec4& cur = src[i];
+			float dCur = planeDistance(cur, plane, guardBand);
+
+			if ((dPrev >= 0.0f) != (dCur >= 0.0f)) {
+				dst[nDst++] = lerp(prev, cur, dPrev / (dPrev - dCur));
+			}
+			if (dCur >= 0.0f) {
+				dst[nDst++] = cur;
+			}
+			dPrev = dCur;
+		}
+
+		if (nDst < 3) {
+			return 0;
+		}
+		std::swap(src, dst);
+		nSrc = nDst;
+	}
+
+	for (int i = 0; i < nSrc; i++) {
+		out[i] = src[i];
+	}
+	return nSrc;
+}
+
+vec4 clipToScreen(const vec4& v, float screenWidth, float screenHeight) {
+	return vec4((1.0f - v.x / v.w) * (0.5f * screenWidth), (1.0f - v.y / v.w) * (0.5f * screenHeight), v.z / v.w);
+}
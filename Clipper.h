@@ -0,0 +1,18 @@
+/* Short description: polygon clipping in homogeneous clip space,
+ * works on fixed size buffers without any allocations
+ */
+
+#pragma once
+
+#include "VertexTransform.h"
+
+// triangle clipped by near, far and 4 guard band planes has at most 9 vertices
+const int maxClippedVerts = 9;
+
+// clip triangle given in homogeneous clip space by planes of planeMask (near,
+// far and guard band clipFlag values, guard band is |x|, |y| <= guardBand * w).
+// Result is convex polygon in out, returns its vertex count, 0 if nothing is left
+int clipTriangle(const vec4 in[3], unsigned int planeMask, float guardBand, vec4 out[maxClippedVerts]);
+
+// perspective divide and viewport scaling, same as transformVertices does
+vec4 clipToScreen(const vec4& v, float screenWidth, float screenHeight);
@@ -0,0 +1,136 @@
+/* Short description: back to front polygon sort by radix sort of
+ * quantized depth keys, reuses order of previous frame when it is close
+ */
+
+#include "DepthSort.h"
+
+#include <cstring>
+
+// first element of block b out of blocks equal parts of [0, n)
+static size_t blockStart(size_t n, size_t b, size_t blocks) {
+	return n * b / blocks;
+}
+
+unsigned int depthSorter::makeKey(const polygon& poly) {
+	// sum orders polygons the same way as average, no need to divide
+	float z = poly.p[0].z + poly.p[1].z + poly.p[2].z;
+
+	// float bits as unsigned number: flip negative numbers and sign bit of positive ones,
+	// so unsigned comparison matches float comparison
+	unsigned int bits;
+	std::memcpy(&bits, &z, sizeof(bits));
+	bits = (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+
+	// farthest polygon has to get smallest key
+	return ~bits;
+}
+
+void depthSorter::sort(std::vector<polygon>& polys, ThreadPool& pool) {
+	size_t n = polys.size();
+	lastReused = false;
+	if (n < 2) {
+		prevOrder.clear();
+		return;
+	}
+
+	size_t blocks = n >= parallelThreshold ? (size_t)pool.size() : 1;
+	keys.resize(n);
+	keysTmp.resize(n);
+
+	// same count of polygons most likely means the same polygons as in previous frame,
+	// their sorted order then needs only few fixes after small camera moves
+	bool fromPrev = reuseOrder && prevOrder.size() == n;
+	pool.parallelFor(blocks, [&](size_t b, int) {
+		size_t first = blockStart(n, b, blocks), last = blockStart(n, b + 1, blocks);
+		for (size_t i = first; i < last; i++) {
+			unsigned int index = fromPrev ? prevOrder[i] : (unsigned int)i;
+			keys[i].key = makeKey(polys[index]);
+			keys[i].index = index;
+		}
+	});
+
+	// insertion sort is linear for nearly sorted keys, limit its work to couple of moves per key
+	if (fromPrev && insertionSort(2 * n)) {
+		lastReused = true;
+	}
+	else {
+		radixSort(pool);
+	}
+
+	// gather polygons in sorted order and keep order for next frame
+	prevOrder.resize(n);
+	sorted.resize(n);
+	pool.parallelFor(blocks, [&](size_t b, int) {
+		size_t first = blockStart(n, b, blocks), last = blockStart(n, b + 1, blocks);
+		for (size_t i = first; i < last; i++) {
+			prevOrder[i] = keys[i].index;
+			sorted[i] = polys[keys[i].index];
+		}
+	});
+	polys.swap(sorted);
+}
+
+bool depthSorter::insertionSort(size_t maxMoves) {
+	size_t moves = 0;
+	for (size_t i = 1; i < keys.size(); i++) {
+		depthKey k = keys[i];
+		size_t j = i;
+		while (j > 0 && keys[j - 1].key > k.key) {
+			keys[j] = keys[j - 1];
+			j--;
+			moves++;
+		}
+		keys[j] = k;
+		if (moves > maxMoves) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void depthSorter::radixSort(ThreadPool& pool) {
+	size_t n = keys.size();
+	size_t blocks = n >= parallelThreshold ? (size_t)pool.size() : 1;
+	histograms.resize(blocks * 256);
+
+	for (int shift = 0; shift < 32; shift += 8) {
+		// count digits of every block
+		pool.parallelFor(blocks, [&](size_t b, int) {
+			size_t* hist = &histograms[b * 256];
+			std::memset(hist, 0, 256 * sizeof(size_t));
+			size_t first = blockStart(n, b, blocks), last = blockStart(n, b + 1, blocks);
+			for (size_t i = first; i < last; i++) {
+				hist[(keys[i].key >> shift) & 0xFF]++;
+			}
+		});
+
+		// digit is the same for all keys, pass would not change order
+		unsigned int digit = (keys[0].key >> shift) & 0xFF;
+		size_t sameDigit = 0;
+		for (size_t b = 0; b < blocks; b++) {
+			sameDigit += histograms[b * 256 + digit];
+		}
+		if (sameDigit == n) {
+			continue;
+		}
+
+		// output offsets, blocks of one digit go in block order to keep sort stable
+		size_t offset = 0;
+		for (int d = 0; d < 256; d++) {
+			for (size_t b = 0; b < blocks; b++) {
+				size_t count = histograms[b * 256 + d];
+				histograms[b * 256 + d] = offset;
+				offset += count;
+			}
+		}
+
+		pool.parallelFor(blocks, [&](size_t b, int) {
+			size_t* dst = &histograms[b * 256];
+			size_t first = blockStart(n, b, blocks), last = blockStart(n, b + 1, blocks);
+			for (size_t i = first; i < last; i++) {
+				keysTmp[dst[(keys[i].key >> shift) & 0xFF]++] = keys[i];
+			}
+		});
+		keys.swap(keysTmp);
+	}
+}
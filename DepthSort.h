@@ -0,0 +1,46 @@
+/* Short description: back to front polygon sort by radix sort of
+ * quantized depth keys, reuses order of previous frame when it is close
+ */
+
+#pragma once
+
+#include "Util.h"
+#include "ThreadPool.h"
+
+#include <vector>
+
+// depth key of polygon and its index in unsorted array
+class depthKey
+{
+public:
+	unsigned int key;
+	unsigned int index;
+};
+
+class depthSorter
+{
+public:
+	size_t parallelThreshold = 65536;	// polygons needed to split radix passes between threads
+	bool reuseOrder = true;				// try order of previous frame before full sort
+	bool lastReused = false;			// last sort was finished from previous order
+
+	// sort polygons back to front by average depth of their vertices
+	void sort(std::vector<polygon>& polys, ThreadPool& pool);
+
+	// key increasing from far to near polygons, computed once per polygon
+	static unsigned int makeKey(const polygon& poly);
+
+private:
+	// finish sort of keys which are nearly in order, gives up after
+	// maxMoves element moves, keys are left partially sorted then
+	bool insertionSort(size_t maxMoves);
+
+	// LSD radix sort by 8 bits, passes where all keys share the digit are skipped
+	void radixSort(ThreadPool& pool);
+
+	std::vector<depthKey> keys;
+	std::vector<depthKey> keysTmp;
+	std::vector<size_t> histograms;		// 256 counters per block
+	std::vector<unsigned int> prevOrder;	// sorted indices of previous frame
+	std::vector<polygon> sorted;
+};
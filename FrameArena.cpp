@@ -0,0 +1,103 @@
+/* Short description: linear allocator for data living one frame,
+ * memory is handed out by moving an offset and taken back all at once
+ */
+
+#include "FrameArena.h"
+
+#include <algorithm>
+
+FrameArena::FrameArena(size_t blockSize) : blockSize(blockSize) {
+}
+
+void* FrameArena::allocate(size_t bytes, size_t alignment) {
+	if (bytes == 0) {
+		bytes = 1;
+	}
+
+	// try current block, then following ones kept from earlier frames, then a new one
+	while (true) {
+		if (current < blocks.size()) {
+			block& b = blocks[current];
+			uintptr_t base = (uintptr_t)b.data.get();
+			uintptr_t aligned = (base + offset + alignment - 1) & ~(uintptr_t)(alignment - 1);
+			size_t end = aligned - base + bytes;
+			if (end <= b.size) {
+				usedBytes += end - offset;
+				offset = end;
+				return (void*)aligned;
+			}
+			if (current + 1 < blocks.size()) {
+				current++;
+				offset = 0;
+				continue;
+			}
+		}
+
+		block b;
+		b.size = std::max(blockSize, bytes + alignment);
+		b.data.reset(new char[b.size]);
+		blocks.push_back(std::move(b));
+		current = blocks.size() - 1;
+		offset = 0;
+	}
+}
+
+void FrameArena::reset() {
+	peakBytes = std::max(peakBytes, usedBytes);
+
+	// next frame of the same size fits into one block
+	if (blocks.size() > 1) {
+		size_t total = capacity();
+		blocks.clear();
+		block b;
+		b.size = total;
+		b.data.reset(new char[b.size]);
+		blocks.push_back(std::move(b));
+	}
+	current = 0;
+	offset = 0;
+	usedBytes = 0;
+}
+
+size_t FrameArena::used() const {
+	return usedBytes;
+}
+
+size_t FrameArena::peak() const {
+	return peakBytes;
+}
+
+size_t FrameArena::capacity() const {
+	size_t total = 0;
+	for (const block& b : blocks) {
+		total += b.size;
+	}
+	return total;
+}
+
+void arenaSet::resize(size_t count) {
+	while (arenas.size() < count) {
+		arenas.emplace_back(new FrameArena());
+	}
+}
+
+FrameArena& arenaSet::operator[](size_t worker) {
+	return *arenas[worker];
+}
+
+size_t arenaSet::reset() {
+	size_t used = 0;
+	for (auto& arena : arenas) {
+		used += arena->used();
+		arena->reset();
+	}
+	return used;
+}
+
+size_t arenaSet::capacity() const {
+	size_t total = 0;
+	for (const auto& arena : arenas) {
+		total += arena->capacity();
+	}
+	return total;
+}
@@ -0,0 +1,117 @@
+/* Short description: linear allocator for data living one frame,
+ * memory is handed out by moving an offset and taken back all at once
+ */
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <type_traits>
+#include <cstdint>
+
+class FrameArena
+{
+public:
+	// first block is allocated on first use
+	explicit FrameArena(size_t blockSize = 1 << 20);
+
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	// bytes aligned to alignment (power of 2), valid until reset
+	void* allocate(size_t bytes, size_t alignment);
+
+	// uninitialized array of count elements
+	template <class T>
+	T* allocate(size_t count) {
+		return (T*)allocate(count * sizeof(T), alignof(T));
+	}
+
+	// take back everything allocated since last reset. Memory is kept for next frame,
+	// blocks are merged into one if frame did not fit into the first one
+	void reset();
+
+	// bytes handed out since last reset, including alignment
+	size_t used() const;
+
+	// largest used() seen at reset
+	size_t peak() const;
+
+	// bytes held by arena
+	size_t capacity() const;
+
+private:
+	struct block
+	{
+		std::unique_ptr<char[]> data;
+		size_t size = 0;
+	};
+
+	std::vector<block> blocks;
+	size_t blockSize;
+	size_t current = 0;		// block allocations come from
+	size_t offset = 0;		// in current block
+	size_t usedBytes = 0;
+	size_t peakBytes = 0;
+};
+
+// standard allocator on top of arena, freeing does nothing, so containers
+// using it must not outlive reset of arena
+template <class T>
+class arenaAllocator
+{
+public:
+	using value_type = T;
+
+	// containers take allocator of container they are moved or copied from,
+	// so output of a worker stays in arena of that worker
+	using propagate_on_container_copy_assignment = std::true_type;
+	using propagate_on_container_move_assignment = std::true_type;
+	using propagate_on_container_swap = std::true_type;
+
+	FrameArena* arena;
+
+	arenaAllocator(FrameArena& arena) : arena(&arena) {}
+
+	template <class U>
+	arenaAllocator(const arenaAllocator<U>& other) : arena(other.arena) {}
+
+	T* allocate(size_t n) {
+		return arena->allocate<T>(n);
+	}
+
+	void deallocate(T*, size_t) {
+	}
+
+	template <class U>
+	bool operator==(const arenaAllocator<U>& other) const {
+		return arena == other.arena;
+	}
+
+	template <class U>
+	bool operator!=(const arenaAllocator<U>& other) const {
+		return arena != other.arena;
+	}
+};
+
+template <class T>
+using arenaVector = std::vector<T, arenaAllocator<T>>;
+
+// one arena per worker of thread pool, worker only allocates from its own
+class arenaSet
+{
+public:
+	std::vector<std::unique_ptr<FrameArena>> arenas;
+
+	// make sure there is an arena for every one of count workers
+	void resize(size_t count);
+
+	FrameArena& operator[](size_t worker);
+
+	// reset all arenas, returns bytes they had used
+	size_t reset();
+
+	// bytes held by all arenas
+	size_t capacity() const;
+};
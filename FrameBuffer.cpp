@@ -0,0 +1,467 @@
+/* Short description: CPU render target with color and depth buffers,
+ * rasterizes screen space polygons with depth test, edge functions
+ * of fixed point vertices are evaluated with SSE / AVX2 kernels
+ */
+
+#include "FrameBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define FRAME_BUFFER_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// side of pixel blocks vector kernels accept or reject at once, divides tile size
+static const int rasterBlock = 8;
+
+void FrameBuffer::resize(int newWidth, int newHeight) {
+	width = newWidth;
+	height = newHeight;
+	color.assign((size_t)width * height, 0);
+	depth.assign((size_t)width * height, 1.0f);
+}
+
+void FrameBuffer::clear(unsigned int clearColor, float clearDepth) {
+	std::fill(color.begin(), color.end(), toPixel(clearColor));
+	std::fill(depth.begin(), depth.end(), clearDepth);
+}
+
+void FrameBuffer::clearTile(int tile, unsigned int clearColor, float clearDepth) {
+	int minX, minY, maxX, maxY;
+	tileRect(tile, minX, minY, maxX, maxY);
+	unsigned int pixel = toPixel(clearColor);
+	for (int y = minY; y <= maxY; y++) {
+		size_t offset = (size_t)y * width;
+		std::fill(color.begin() + offset + minX, color.begin() + offset + maxX + 1, pixel);
+		std::fill(depth.begin() + offset + minX, depth.begin() + offset + maxX + 1, clearDepth);
+	}
+}
+
+void FrameBuffer::drawTriangle(const polygon& poly) {
+	drawTriangle(poly, 0, 0, width - 1, height - 1);
+}
+
+bool rasterTriangle::setup(const polygon& poly) {
+	// snap to subpixel grid, invalid coordinates are rejected before conversion
+	const float scale = (float)(1 << subpixelBits);
+	int64_t x[3], y[3];
+	float z[3];
+	for (int i = 0; i < 3; i++) {
+		if (!(std::fabs(poly.p[i].x) < 1e9f && std::fabs(poly.p[i].y) < 1e9f)) {
+			return false;
+		}
+		x[i] = (int64_t)std::floor(poly.p[i].x * scale + 0.5f);
+		y[i] = (int64_t)std::floor(poly.p[i].y * scale + 0.5f);
+		z[i] = poly.p[i].z;
+	}
+	int64_t minSubX = std::min({ x[0], x[1], x[2] });
+	int64_t maxSubX = std::max({ x[0], x[1], x[2] });
+	int64_t minSubY = std::min({ y[0], y[1], y[2] });
+	int64_t maxSubY = std::max({ y[0], y[1], y[2] });
+	const int64_t maxSubSize = (int64_t)maxSize << subpixelBits;
+	if (maxSubX - minSubX > maxSubSize || maxSubY - minSubY > maxSubSize) {
+		// guard band should have clipped it, something bypassed effectiveGuardBand
+		static std::once_flag reported;
+		std::call_once(reported, [&]() {
+			std::cerr << "Triangle of " << ((maxSubX - minSubX) >> subpixelBits) << " x " << ((maxSubY - minSubY) >> subpixelBits)
+				<< " pixels is larger than rasterizer limit of " << maxSize << ", it is not drawn" << std::endl;
+		});
+		return false;
+	}
+
+	// doubled signed area, polygons of both windings are drawn
+	int64_t doubleArea = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+	if (doubleArea == 0) {
+		return false;
+	}
+	if (doubleArea < 0) {
+		std::swap(x[1], x[2]);
+		std::swap(y[1], y[2]);
+		std::swap(z[1], z[2]);
+		doubleArea = -doubleArea;
+	}
+
+	// edge functions E(a, b, p) = (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x),
+	// each edge is opposite to the vertex it weights, center of pixel (px, py) is at
+	// subpixel (16 * px + 8, 16 * py + 8)
+	const int edgeA[3] = { 1, 2, 0 };
+	const int edgeB[3] = { 2, 0, 1 };
+	const int64_t half = 1 << (subpixelBits - 1);
+	for (int e = 0; e < 3; e++) {
+		int64_t dx = x[edgeB[e]] - x[edgeA[e]];
+		int64_t dy = y[edgeB[e]] - y[edgeA[e]];
+		// top-left fill rule: pixels exactly on the edge belong to top and left edges only
+		bool topLeft = (dy == 0 && dx > 0) || dy < 0;
+		stepX[e] = -dy * (1 << subpixelBits);
+		stepY[e] = dx * (1 << subpixelBits);
+		origin[e] = dx * (half - y[edgeA[e]]) - dy * (half - x[edgeA[e]]) - (topLeft ? 0 : 1);
+	}
+
+	// depth is affine in screen space after perspective divide
+	float fx[3], fy[3];
+	for (int i = 0; i < 3; i++) {
+		fx[i] = (float)x[i] / scale;
+		fy[i] = (float)y[i] / scale;
+	}
+	float fArea = (float)doubleArea / (scale * scale);
+	x0 = fx[0];
+	y0 = fy[0];
+	z0 = z[0];
+	dzdx = ((z[1] - z[0]) * (fy[2] - fy[0]) - (z[2] - z[0]) * (fy[1] - fy[0])) / fArea;
+	dzdy = ((z[2] - z[0]) * (fx[1] - fx[0]) - (z[1] - z[0]) * (fx[2] - fx[0])) / fArea;
+	maxZ = std::max({ z[0], z[1], z[2] });
+	area = 0.5f * fArea;
+
+	// first and last pixel centers inside of bounds, shifts round down also below 0
+	minX = (int)((minSubX - half + (1 << subpixelBits) - 1) >> subpixelBits);
+	minY = (int)((minSubY - half + (1 << subpixelBits) - 1) >> subpixelBits);
+	maxX = (int)((maxSubX - half) >> subpixelBits);
+	maxY = (int)((maxSubY - half) >> subpixelBits);
+	return minX <= maxX && minY <= maxY;
+}
+
+// part of triangle inside of one tile for raster kernels. Edge functions are relative
+// to the tile corner, with vertices snapped and triangle size limited they fit
+// into 32 bits everywhere in the tile
+struct rasterArgs
+{
+	const rasterTriangle* tri;
+	int originX, originY;			// corner of tile
+	int minX, minY, maxX, maxY;		// pixels to draw, inclusive
+	int edge[3];					// edge functions at the corner, 0 with no steps for edges not crossing the part
+	int stepX[3], stepY[3];
+	float* depth;
+	unsigned int* color;
+	int width;
+	unsigned int pixel;
+};
+
+// reference kernel, pixel by pixel
+static void rasterScalar(const rasterArgs& a) {
+	const rasterTriangle& t = *a.tri;
+	for (int y = a.minY; y <= a.maxY; y++) {
+		int e0 = a.edge[0] + a.stepX[0] * (a.minX - a.originX) + a.stepY[0] * (y - a.originY);
+		int e1 = a.edge[1] + a.stepX[1] * (a.minX - a.originX) + a.stepY[1] * (y - a.originY);
+		int e2 = a.edge[2] + a.stepX[2] * (a.minX - a.originX) + a.stepY[2] * (y - a.originY);
+		float row = t.rowDepth(y);
+		size_t offset = (size_t)y * a.width;
+
+		for (int x = a.minX; x <= a.maxX; x++) {
+			// all three are not negative
+			if ((e0 | e1 | e2) >= 0) {
+				float z = t.depth(row, x);
+				if (z < a.depth[offset + x]) {
+					a.depth[offset + x] = z;
+					a.color[offset + x] = a.pixel;
+				}
+			}
+			e0 += a.stepX[0];
+			e1 += a.stepX[1];
+			e2 += a.stepX[2];
+		}
+	}
+}
+
+// pixels of 8 x 8 block inside of rectangle drawn by scalar kernel
+static void rasterBlockScalar(const rasterArgs& a, int blockX, int blockY) {
+	rasterArgs block = a;
+	block.minX = std::max(a.minX, blockX);
+	block.minY = std::max(a.minY, blockY);
+	block.maxX = std::min(a.maxX, blockX + rasterBlock - 1);
+	block.maxY = std::min(a.maxY, blockY + rasterBlock - 1);
+	rasterScalar(block);
+}
+
+// edge functions at block corner, true if the block has covered pixels,
+// inside is set if it is covered whole
+static bool classifyBlock(const rasterArgs& a, int blockX, int blockY, int e[3], bool& inside) {
+	inside = true;
+	for (int k = 0; k < 3; k++) {
+		e[k] = a.edge[k] + a.stepX[k] * (blockX - a.originX) + a.stepY[k] * (blockY - a.originY);
+		int spanX = a.stepX[k] * (rasterBlock - 1);
+		int spanY = a.stepY[k] * (rasterBlock - 1);
+		if (e[k] + std::max(spanX, 0) + std::max(spanY, 0) < 0) return false;
+		if (e[k] + std::min(spanX, 0) + std::min(spanY, 0) < 0) inside = false;
+	}
+	return true;
+}
+
+#ifdef FRAME_BUFFER_X86
+
+// 8 x 8 blocks aligned to the screen, every row as two vectors of 4 pixels.
+// Blocks stay inside of their tile, pixels outside of rectangle are written back unchanged
+static void rasterSSE(const rasterArgs& a) {
+	const rasterTriangle& t = *a.tri;
+	const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+	__m128i laneSteps[3];
+	for (int k = 0; k < 3; k++) {
+		laneSteps[k] = _mm_setr_epi32(0, a.stepX[k], a.stepX[k] * 2, a.stepX[k] * 3);
+	}
+	const __m128 x0 = _mm_set1_ps(t.x0);
+	const __m128 dzdx = _mm_set1_ps(t.dzdx);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128i pixel = _mm_set1_epi32((int)a.pixel);
+
+	for (int blockY = a.minY & ~(rasterBlock - 1); blockY <= a.maxY; blockY += rasterBlock) {
+		for (int blockX = a.minX & ~(rasterBlock - 1); blockX <= a.maxX; blockX += rasterBlock) {
+			int e[3];
+			bool inside;
+			if (!classifyBlock(a, blockX, blockY, e, inside)) {
+				continue;
+			}
+			if (blockX + rasterBlock > a.width) {
+				// last block of row sticks out of the buffer
+				rasterBlockScalar(a, blockX, blockY);
+				continue;
+			}
+
+			// columns of block inside of rectangle
+			__m128i valid[2];
+			for (int h = 0; h < 2; h++) {
+				__m128i xs = _mm_add_epi32(_mm_set1_epi32(blockX + h * 4), lanes);
+				valid[h] = _mm_and_si128(_mm_cmpgt_epi32(xs, _mm_set1_epi32(a.minX - 1)), _mm_cmplt_epi32(xs, _mm_set1_epi32(a.maxX + 1)));
+			}
+
+			int lastY = std::min(a.maxY, blockY + rasterBlock - 1);
+			for (int y = std::max(a.minY, blockY); y <= lastY; y++) {
+				float row = t.rowDepth(y);
+				size_t offset = (size_t)y * a.width;
+				for (int h = 0; h < 2; h++) {
+					int x = blockX + h * 4;
+					__m128i mask = valid[h];
+					if (!inside) {
+						__m128i any = _mm_setzero_si128();
+						for (int k = 0; k < 3; k++) {
+							int rowEdge = e[k] + a.stepY[k] * (y - blockY) + a.stepX[k] * h * 4;
+							any = _mm_or_si128(any, _mm_add_epi32(_mm_set1_epi32(rowEdge), laneSteps[k]));
+						}
+						mask = _mm_andnot_si128(_mm_srai_epi32(any, 31), mask);
+					}
+					if (_mm_movemask_epi8(mask) == 0) {
+						continue;
+					}
+
+					__m128 px = _mm_add_ps(_mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(x), lanes)), half);
+					__m128 z = _mm_add_ps(_mm_set1_ps(row), _mm_mul_ps(dzdx, _mm_sub_ps(px, x0)));
+					float* depthRow = a.depth + offset + x;
+					unsigned int* colorRow = a.color + offset + x;
+					__m128 oldDepth = _mm_loadu_ps(depthRow);
+					__m128 write = _mm_and_ps(_mm_castsi128_ps(mask), _mm_cmplt_ps(z, oldDepth));
+					__m128i writeInt = _mm_castps_si128(write);
+					__m128i oldColor = _mm_loadu_si128((const __m128i*)colorRow);
+					_mm_storeu_ps(depthRow, _mm_or_ps(_mm_and_ps(write, z), _mm_andnot_ps(write, oldDepth)));
+					_mm_storeu_si128((__m128i*)colorRow, _mm_or_si128(_mm_and_si128(writeInt, pixel), _mm_andnot_si128(writeInt, oldColor)));
+				}
+			}
+		}
+	}
+}
+
+// the same with rows of 8 pixels as one vector
+TARGET_AVX2 static void rasterAVX2(const rasterArgs& a) {
+	const rasterTriangle& t = *a.tri;
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i laneSteps[3];
+	for (int k = 0; k < 3; k++) {
+		laneSteps[k] = _mm256_mullo_epi32(_mm256_set1_epi32(a.stepX[k]), lanes);
+	}
+	const __m256 x0 = _mm256_set1_ps(t.x0);
+	const __m256 dzdx = _mm256_set1_ps(t.dzdx);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256i pixel = _mm256_set1_epi32((int)a.pixel);
+
+	for (int blockY = a.minY & ~(rasterBlock - 1); blockY <= a.maxY; blockY += rasterBlock) {
+		for (int blockX = a.minX & ~(rasterBlock - 1); blockX <= a.maxX; blockX += rasterBlock) {
+			int e[3];
+			bool inside;
+			if (!classifyBlock(a, blockX, blockY, e, inside)) {
+				continue;
+			}
+			if (blockX + rasterBlock > a.width) {
+				rasterBlockScalar(a, blockX, blockY);
+				continue;
+			}
+
+			__m256i xs = _mm256_add_epi32(_mm256_set1_epi32(blockX), lanes);
+			__m256i valid = _mm256_and_si256(_mm256_cmpgt_epi32(xs, _mm256_set1_epi32(a.minX - 1)), _mm256_cmpgt_epi32(_mm256_set1_epi32(a.maxX + 1), xs));
+			__m256 px = _mm256_add_ps(_mm256_cvtepi32_ps(xs), half);
+			__m256 planeX = _mm256_mul_ps(dzdx, _mm256_sub_ps(px, x0));
+
+			int lastY = std::min(a.maxY, blockY + rasterBlock - 1);
+			for (int y = std::max(a.minY, blockY); y <= lastY; y++) {
+				__m256i mask = valid;
+				if (!inside) {
+					__m256i any = _mm256_setzero_si256();
+					for (int k = 0; k < 3; k++) {
+						int rowEdge = e[k] + a.stepY[k] * (y - blockY);
+						any = _mm256_or_si256(any, _mm256_add_epi32(_mm256_set1_epi32(rowEdge), laneSteps[k]));
+					}
+					mask = _mm256_andnot_si256(_mm256_srai_epi32(any, 31), mask);
+				}
+				if (_mm256_movemask_epi8(mask) == 0) {
+					continue;
+				}
+
+				size_t offset = (size_t)y * a.width + blockX;
+				__m256 z = _mm256_add_ps(_mm256_set1_ps(t.rowDepth(y)), planeX);
+				__m256 oldDepth = _mm256_loadu_ps(a.depth + offset);
+				__m256 write = _mm256_and_ps(_mm256_castsi256_ps(mask), _mm256_cmp_ps(z, oldDepth, _CMP_LT_OQ));
+				__m256i oldColor = _mm256_loadu_si256((const __m256i*)(a.color + offset));
+				_mm256_storeu_ps(a.depth + offset, _mm256_blendv_ps(oldDepth, z, write));
+				_mm256_storeu_si256((__m256i*)(a.color + offset), _mm256_blendv_epi8(oldColor, pixel, _mm256_castps_si256(write)));
+			}
+		}
+	}
+	_mm256_zeroupper();
+}
+
+#endif
+
+void FrameBuffer::drawTriangle(const polygon& poly, int clipMinX, int clipMinY, int clipMaxX, int clipMaxY) {
+	rasterTriangle tri;
+	if (!tri.setup(poly)) {
+		return;
+	}
+	int minX = std::max({ tri.minX, clipMinX, 0 });
+	int minY = std::max({ tri.minY, clipMinY, 0 });
+	int maxX = std::min({ tri.maxX, clipMaxX, width - 1 });
+	int maxY = std::min({ tri.maxY, clipMaxY, height - 1 });
+	if (minX > maxX || minY > maxY) {
+		return;
+	}
+
+	rasterArgs a;
+	a.tri = &tri;
+	a.depth = depth.data();
+	a.color = color.data();
+	a.width = width;
+	a.pixel = toPixel(poly.color | 0x000000FF);
+
+	// tile by tile, so edge functions fit into 32 bits
+	for (int tileY = minY - minY % tileSize; tileY <= maxY; tileY += tileSize) {
+		for (int tileX = minX - minX % tileSize; tileX <= maxX; tileX += tileSize) {
+			a.originX = tileX;
+			a.originY = tileY;
+			a.minX = std::max(minX, tileX);
+			a.minY = std::max(minY, tileY);
+			a.maxX = std::min(maxX, tileX + tileSize - 1);
+			a.maxY = std::min(maxY, tileY + tileSize - 1);
+
+			// edges which do not cross the part are left out, part outside of one is skipped
+			bool empty = false;
+			for (int e = 0; e < 3 && !empty; e++) {
+				int64_t value = tri.edge(e, a.minX, a.minY);
+				int64_t spanX = tri.stepX[e] * (a.maxX - a.minX);
+				int64_t spanY = tri.stepY[e] * (a.maxY - a.minY);
+				int64_t lowest = value + std::min(spanX, (int64_t)0) + std::min(spanY, (int64_t)0);
+				int64_t highest = value + std::max(spanX, (int64_t)0) + std::max(spanY, (int64_t)0);
+				if (highest < 0) {
+					empty = true;
+				}
+				else if (lowest >= 0) {
+					a.edge[e] = 0;
+					a.stepX[e] = 0;
+					a.stepY[e] = 0;
+				}
+				else {
+					a.edge[e] = (int)tri.edge(e, tileX, tileY);
+					a.stepX[e] = (int)tri.stepX[e];
+					a.stepY[e] = (int)tri.stepY[e];
+				}
+			}
+			if (empty) {
+				continue;
+			}
+
+#ifdef FRAME_BUFFER_X86
+			if (rasterPath == TRANSFORM_AVX2) {
+				rasterAVX2(a);
+				continue;
+			}
+			if (rasterPath == TRANSFORM_SSE) {
+				rasterSSE(a);
+				continue;
+			}
+#endif
+			rasterScalar(a);
+		}
+	}
+}
+
+int FrameBuffer::tilesX() const {
+	return (width + tileSize - 1) / tileSize;
+}
+
+int FrameBuffer::tilesY() const {
+	return (height + tileSize - 1) / tileSize;
+}
+
+void FrameBuffer::tileRect(int tile, int& minX, int& minY, int& maxX, int& maxY) const {
+	minX = (tile % tilesX()) * tileSize;
+	minY = (tile / tilesX()) * tileSize;
+	maxX = std::min(minX + tileSize, width) - 1;
+	maxY = std::min(minY + tileSize, height) - 1;
+}
+
+bool FrameBuffer::polygonBounds(const polygon& poly, int& minX, int& minY, int& maxX, int& maxY) const {
+	float fMinX = std::min({ poly.p[0].x, poly.p[1].x, poly.p[2].x });
+	float fMaxX = std::max({ poly.p[0].x, poly.p[1].x, poly.p[2].x });
+	float fMinY = std::min({ poly.p[0].y, poly.p[1].y, poly.p[2].y });
+	float fMaxY = std::max({ poly.p[0].y, poly.p[1].y, poly.p[2].y });
+
+	// also rejects NaN coordinates
+	if (!(fMaxX >= 0.0f && fMaxY >= 0.0f && fMinX <= (float)width - 1 && fMinY <= (float)height - 1)) {
+		return false;
+	}
+	minX = (int)std::max(0.0f, std::floor(fMinX));
+	minY = (int)std::max(0.0f, std::floor(fMinY));
+	maxX = (int)std::min((float)width - 1, std::ceil(fMaxX));
+	maxY = (int)std::min((float)height - 1, std::ceil(fMaxY));
+	return minX <= maxX && minY <= maxY;
+}
+
+const unsigned char* FrameBuffer::pixels() const {
+	return reinterpret_cast<const unsigned char*>(color.data());
+}
+
+bool FrameBuffer::savePPM(const std::string& filename) const {
+	std::ofstream f(filename, std::ios::binary);
+	if (!f.is_open()) return false;
+
+	f << "P6\n" << width << " " << height << "\n255\n";
+	const unsigned char* src = pixels();
+	std::vector<unsigned char> row((size_t)width * 3);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			const unsigned char* p = src + ((size_t)y * width + x) * 4;
+			row[x * 3 + 0] = p[0];
+			row[x * 3 + 1] = p[1];
+			row[x * 3 + 2] = p[2];
+		}
+		f.write(reinterpret_cast<const char*>(row.data()), row.size());
+	}
+	return f.good();
+}
+
+unsigned int FrameBuffer::toPixel(unsigned int rgba) {
+	unsigned char bytes[4] = {
+		(unsigned char)(rgba >> 24),
+		(unsigned char)(rgba >> 16),
+		(unsigned char)(rgba >> 8),
+		(unsigned char)(rgba)
+	};
+	unsigned int pixel;
+	std::memcpy(&pixel, bytes, sizeof(pixel));
+	return pixel;
+}
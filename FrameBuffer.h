@@ -0,0 +1,107 @@
+/* Short description: CPU render target with color and depth buffers,
+ * rasterizes screen space polygons with depth test, edge functions
+ * of fixed point vertices are evaluated with SSE / AVX2 kernels
+ */
+
+#pragma once
+
+#include "Util.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// screen space triangle with vertices snapped to 1 / 16 of pixel, integer edge functions
+// and depth plane. Frame buffer and occlusion buffer both rasterize through it,
+// so they cover exactly the same pixels
+class rasterTriangle
+{
+public:
+	static const int subpixelBits = 4;
+	static const int maxSize = maxRasterSize;	// larger triangles are not drawn, edge functions of a tile would overflow 32 bits
+
+	// pixel (x, y) is covered if edge(e, x, y) >= 0 for all 3 edges, edges are sampled
+	// at pixel centers and top-left fill rule is folded into origin
+	int64_t stepX[3];
+	int64_t stepY[3];
+	int64_t origin[3];			// value at pixel (0, 0)
+
+	// depth plane through snapped vertices, see depth()
+	float x0, y0, z0;
+	float dzdx, dzdy;
+	float maxZ;					// farthest vertex
+	float area;					// in pixels
+
+	int minX, minY, maxX, maxY;	// pixels whose centers can be covered, not clamped to screen
+
+	// snap polygon and set up edges, false for degenerate polygons, polygons with
+	// invalid coordinates and polygons larger than maxSize pixels. Guard band clipping
+	// keeps polygons within maxSize, larger ones are reported on stderr once
+	bool setup(const polygon& poly);
+
+	int64_t edge(int e, int x, int y) const {
+		return origin[e] + stepX[e] * x + stepY[e] * y;
+	}
+
+	// depth at center of pixel row y and then of pixel x in it,
+	// every raster kernel uses exactly this arithmetic
+	float rowDepth(int y) const {
+		return z0 + dzdy * ((float)y + 0.5f - y0);
+	}
+	float depth(float row, int x) const {
+		return row + dzdx * ((float)x + 0.5f - x0);
+	}
+};
+
+class FrameBuffer
+{
+public:
+	// side of square screen tiles, which are rasterized independently
+	static const int tileSize = 64;
+
+	int width = 0;
+	int height = 0;
+
+	// pixels in memory byte order R, G, B, A (ready for texture upload)
+	std::vector<unsigned int> color;
+	// depth after perspective divide, 0 - near plane, 1 - far plane
+	std::vector<float> depth;
+	// raster kernel, all of them cover the same pixels as the scalar one
+	transformPath rasterPath = bestTransformPath();
+
+	// allocate color and depth targets
+	void resize(int newWidth, int newHeight);
+
+	// fill color target with RGBA color and depth target with given value
+	void clear(unsigned int clearColor = 0x000000FF, float clearDepth = 1.0f);
+
+	// clear only pixels of one tile
+	void clearTile(int tile, unsigned int clearColor = 0x000000FF, float clearDepth = 1.0f);
+
+	// rasterize screen space polygon with depth test, color in RGBA format
+	void drawTriangle(const polygon& poly);
+
+	// rasterize polygon touching only pixels of rectangle [minX, maxX] x [minY, maxY],
+	// pixels of its tiles outside of it may be read and written back unchanged,
+	// so threads have to draw into different tiles
+	void drawTriangle(const polygon& poly, int clipMinX, int clipMinY, int clipMaxX, int clipMaxY);
+
+	// number of tiles covering the buffer
+	int tilesX() const;
+	int tilesY() const;
+
+	// pixel rectangle of tile, inclusive
+	void tileRect(int tile, int& minX, int& minY, int& maxX, int& maxY) const;
+
+	// pixel bounding box of polygon clamped to the buffer, false if it is outside or invalid
+	bool polygonBounds(const polygon& poly, int& minX, int& minY, int& maxX, int& maxY) const;
+
+	// raw pixel data, width * height * 4 bytes
+	const unsigned char* pixels() const;
+
+	// write color target as binary PPM image
+	bool savePPM(const std::string& filename) const;
+
+	// convert RGBA color (as in polygon::color) into memory byte order
+	static unsigned int toPixel(unsigned int rgba);
+};
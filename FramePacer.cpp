@@ -0,0 +1,63 @@
+/* Short description: frame rate limiter with deadlines on monotonic clock,
+ * keeps rolling statistics of frame times and input to present latency
+ */
+
+#include "FramePacer.h"
+
+#include "SFML/System.hpp"
+
+#include <thread>
+
+static double toMs(FramePacer::clock::duration duration) {
+	return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+void FramePacer::start() {
+	deadline = clock::now();
+	presented = false;
+	lastFrameMs = 0.0f;
+	frameTimes.clear();
+	latency.clear();
+}
+
+void FramePacer::wait() {
+	if (frameRate <= 0) {
+		return;
+	}
+	clock::duration period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / frameRate));
+	clock::duration spin = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double, std::milli>(spinMs));
+
+	deadline += period;
+	clock::time_point now = clock::now();
+	if (now >= deadline) {
+		// missed by more than a whole frame, start again instead of rushing frames to catch up
+		if (now - deadline >= period) {
+			deadline = now;
+		}
+		return;
+	}
+
+	// sleep is coarse, sf::sleep raises timer resolution on Windows
+	// while it waits, so it wakes up within the spin part
+	if (deadline - now > spin) {
+		sf::sleep(sf::microseconds(std::chrono::duration_cast<std::chrono::microseconds>(deadline - now - spin).count()));
+	}
+	while (clock::now() < deadline) {
+		std::this_thread::yield();
+	}
+}
+
+void FramePacer::framePresented(clock::time_point inputTime) {
+	clock::time_point now = clock::now();
+	if (presented) {
+		lastFrameMs = (float)toMs(now - lastPresent);
+		frameTimes.add(lastFrameMs);
+	}
+	latency.add(toMs(now - inputTime));
+	lastPresent = now;
+	presented = true;
+}
+
+float FramePacer::lastFrameTime() const {
+	return lastFrameMs;
+}
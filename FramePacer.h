@@ -0,0 +1,40 @@
+/* Short description: frame rate limiter with deadlines on monotonic clock,
+ * keeps rolling statistics of frame times and input to present latency
+ */
+
+#pragma once
+
+#include "FrameStats.h"
+
+#include <chrono>
+
+class FramePacer
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	int frameRate = 60;			// frames per second, 0 - no limit
+	double spinMs = 2.0;		// last part of the wait spent spinning, OS sleep may overshoot by about this much
+	rollingHistogram frameTimes;	// ms between presents of consecutive frames
+	rollingHistogram latency;		// ms from polling input of frame to its present
+
+	// start deadlines from now, statistics are cleared
+	void start();
+
+	// wait until the next frame is due, returns at once when behind or there is no limit.
+	// Deadlines advance by whole frame periods, so a late frame is not carried into
+	// the next ones; after falling behind by more than a frame pacing starts again from now
+	void wait();
+
+	// frame polled its input at inputTime and was just presented
+	void framePresented(clock::time_point inputTime);
+
+	// ms between the last two presents
+	float lastFrameTime() const;
+
+private:
+	clock::time_point deadline;		// when the next frame is due
+	clock::time_point lastPresent;
+	float lastFrameMs = 0.0f;
+	bool presented = false;			// lastPresent is valid
+};
@@ -0,0 +1,116 @@
+/* Short description: timings of render stages and
+ * statistics over series of frames
+ */
+
+#include "FrameStats.h"
+
+#include <algorithm>
+#include <cmath>
+
+const char* renderStageName(renderStage stage) {
+	switch (stage) {
+	case STAGE_CULL: return "cull";
+	case STAGE_TRANSFORM: return "transform";
+	case STAGE_GEOMETRY: return "geometry";
+	case STAGE_OCCLUSION: return "occlusion";
+	case STAGE_MERGE: return "merge";
+	case STAGE_SORT: return "sort";
+	case STAGE_RASTER: return "raster";
+	case STAGE_SUBMIT: return "submit";
+	default: return "unknown";
+	}
+}
+
+void sampleStats::add(double value) {
+	samples.push_back(value);
+}
+
+void sampleStats::clear() {
+	samples.clear();
+}
+
+size_t sampleStats::count() const {
+	return samples.size();
+}
+
+double sampleStats::mean() const {
+	if (samples.empty()) return 0.0;
+	double sum = 0.0;
+	for (double s : samples) {
+		sum += s;
+	}
+	return sum / samples.size();
+}
+
+double sampleStats::max() const {
+	if (samples.empty()) return 0.0;
+	return *std::max_element(samples.begin(), samples.end());
+}
+
+double sampleStats::percentile(double p) const {
+	if (samples.empty()) return 0.0;
+
+	// smallest sample with at least p percent of samples not above it
+	size_t rank = (size_t)std::ceil(p / 100.0 * samples.size());
+	rank = std::min(std::max(rank, (size_t)1), samples.size());
+
+	std::vector<double> sorted = samples;
+	std::nth_element(sorted.begin(), sorted.begin() + (rank - 1), sorted.end());
+	return sorted[rank - 1];
+}
+
+rollingHistogram::rollingHistogram(size_t windowSize, double bucketWidth, size_t bucketCount)
+	: buckets(bucketCount + 1, 0), window(std::max(windowSize, (size_t)1), 0.0), bucketWidth(bucketWidth) {
+}
+
+size_t rollingHistogram::bucketOf(double value) const {
+	// bucket i holds values in (i * width, (i + 1) * width]
+	double position = std::ceil(value / bucketWidth) - 1.0;
+	if (!(position >= 0.0)) return 0;
+	return (size_t)std::min(position, (double)(buckets.size() - 1));
+}
+
+void rollingHistogram::add(double value) {
+	// oldest sample leaves the window
+	if (filled == window.size()) {
+		buckets[bucketOf(window[next])]--;
+	}
+	else {
+		filled++;
+	}
+	window[next] = value;
+	buckets[bucketOf(value)]++;
+	next = (next + 1) % window.size();
+}
+
+void rollingHistogram::clear() {
+	std::fill(buckets.begin(), buckets.end(), 0);
+	next = 0;
+	filled = 0;
+}
+
+size_t rollingHistogram::count() const {
+	return filled;
+}
+
+double rollingHistogram::percentile(double p) const {
+	if (filled == 0) return 0.0;
+
+	size_t rank = (size_t)std::ceil(p / 100.0 * filled);
+	rank = std::min(std::max(rank, (size_t)1), filled);
+
+	size_t seen = 0;
+	for (size_t i = 0; i + 1 < buckets.size(); i++) {
+		seen += buckets[i];
+		if (seen >= rank) {
+			return (i + 1) * bucketWidth;
+		}
+	}
+
+	// overflow bucket has no upper edge, only the slowest frames land there
+	double largest = 0.0;
+	for (size_t i = 0; i < filled; i++) {
+		largest = std::max(largest, window[i]);
+	}
+	return largest;
+}
@@ -0,0 +1,94 @@
+/* Short description: timings of render stages and
+ * statistics over series of frames
+ */
+
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+// stages of RenderEngine::render in the order they run
+enum renderStage
+{
+	STAGE_CULL,			// frustum culling of mesh clusters, splitting work into tasks
+	STAGE_TRANSFORM,	// world, view and projection transform of vertices
+	STAGE_GEOMETRY,		// polygon assembly, back face culling, lighting and clipping
+	STAGE_OCCLUSION,	// drawing occluders into depth pyramid and testing clusters against it
+	STAGE_MERGE,		// joining outputs of geometry tasks
+	STAGE_SORT,			// back to front sort
+	STAGE_RASTER,		// binning and CPU rasterization
+	STAGE_SUBMIT,		// building and drawing SFML shapes
+	STAGE_COUNT
+};
+
+// stage name for logs and reports
+const char* renderStageName(renderStage stage);
+
+// inputs of render which changed since previous frame, decide what has to be redone
+enum frameChange
+{
+	CHANGED_WORLD = 1,		// transform or level of detail of some instance, instances added or removed
+	CHANGED_CAMERA = 2,		// camera position or direction
+	CHANGED_PROJECTION = 4,	// projection matrix
+	CHANGED_VIEWPORT = 8,	// frame size
+	CHANGED_SETTINGS = 16,	// culling, clipping or drawing options
+	CHANGED_ALL = 31
+};
+
+// time spent in every stage during one frame, skipped stages are 0
+class frameStats
+{
+public:
+	double ms[STAGE_COUNT] = {};
+	unsigned int changes = 0;	// frameChange flags, 0 - previous frame was shown again
+	size_t cachedInstances = 0;	// visible instances drawn from world space cache
+	size_t occludedLeaves = 0;	// mesh clusters in view frustum skipped as hidden behind others
+	size_t arenaBytes = 0;		// transient memory of geometry and raster taken from frame arenas
+	size_t worldCacheBytes = 0;	// memory held by world space caches of instances
+};
+
+// series of measurements, e.g. one stage over many frames
+class sampleStats
+{
+public:
+	std::vector<double> samples;
+
+	void add(double value);
+	void clear();
+	size_t count() const;
+
+	double mean() const;
+	double max() const;
+
+	// nearest rank percentile, p in [0, 100]
+	double percentile(double p) const;
+};
+
+// distribution of the last windowSize samples in fixed width buckets, for percentiles
+// of values which keep coming, e.g. frame times of interactive loop.
+// Adding a sample is constant time and no memory is allocated after construction
+class rollingHistogram
+{
+public:
+	// bucketWidth * bucketCount is the largest value with exact bucket,
+	// larger ones share the last bucket
+	explicit rollingHistogram(size_t windowSize = 1024, double bucketWidth = 0.1, size_t bucketCount = 1000);
+
+	void add(double value);
+	void clear();
+	size_t count() const;
+
+	// nearest rank percentile, p in [0, 100], upper edge of the bucket it falls into,
+	// so it is never below the sample and at most bucketWidth above.
+	// Samples beyond the last bucket give largest of them
+	double percentile(double p) const;
+
+private:
+	std::vector<unsigned int> buckets;	// samples per bucket in current window
+	std::vector<double> window;			// ring of the last samples
+	size_t next = 0;					// position in window the next sample goes to
+	size_t filled = 0;					// samples in window
+	double bucketWidth;
+
+	size_t bucketOf(double value) const;
+};
@@ -0,0 +1,115 @@
+/* Short description: read only memory mapped file, for loading
+ * assets without copying them through stream buffers
+ */
+
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() {}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& filename) {
+	close();
+
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)) {
+		CloseHandle(file);
+		return false;
+	}
+	fileHandle = file;
+	mappedSize = (size_t)fileSize.QuadPart;
+
+	// empty files can not be mapped, but they are still valid
+	if (mappedSize == 0) return true;
+
+	mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mappingHandle == nullptr) {
+		close();
+		return false;
+	}
+
+	mappedData = (const char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (mappedData == nullptr) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close() {
+	if (mappedData) UnmapViewOfFile(mappedData);
+	if (mappingHandle) CloseHandle(mappingHandle);
+	if (fileHandle) CloseHandle(fileHandle);
+	mappedData = nullptr;
+	mappingHandle = nullptr;
+	fileHandle = nullptr;
+	mappedSize = 0;
+}
+
+#else
+
+bool MappedFile::open(const std::string& filename) {
+	close();
+
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		::close(fd);
+		return false;
+	}
+
+	// empty files can not be mapped, but they are still valid
+	mappedSize = (size_t)st.st_size;
+	if (mappedSize == 0) {
+		::close(fd);
+		return true;
+	}
+
+	void* p = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	// mapping stays valid after descriptor is closed
+	::close(fd);
+	if (p == MAP_FAILED) {
+		mappedSize = 0;
+		return false;
+	}
+	madvise(p, mappedSize, MADV_SEQUENTIAL);
+	mappedData = (const char*)p;
+	return true;
+}
+
+void MappedFile::close() {
+	if (mappedData) munmap((void*)mappedData, mappedSize);
+	mappedData = nullptr;
+	mappedSize = 0;
+}
+
+#endif
+
+const char* MappedFile::data() const {
+	return mappedData;
+}
+
+size_t MappedFile::size() const {
+	return mappedSize;
+}
@@ -0,0 +1,39 @@
+/* Short description: read only memory mapped file, for loading
+ * assets without copying them through stream buffers
+ */
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	// file mapping is not copyable, it owns OS handles
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// map whole file into memory, false if it can not be opened
+	bool open(const std::string& filename);
+
+	// unmap file and release handles
+	void close();
+
+	// start of file contents, nullptr for empty or closed file
+	const char* data() const;
+
+	// file size in bytes
+	size_t size() const;
+
+private:
+	const char* mappedData = nullptr;
+	size_t mappedSize = 0;
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#endif
+};
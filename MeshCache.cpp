@@ -0,0 +1,366 @@
+/* Short description: versioned binary mesh format, which is loaded by
+ * memory mapping without any parsing, and used as a cache of obj files
+ */
+
+#include "MeshCache.h"
+#include "MappedFile.h"
+#include "Profiler.h"
+#include "Scene.h"
+
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+static const uint32_t byteOrderMark = 0x01020304;
+static const uint64_t sectionAlignment = 64;
+
+// nodes are written as they are in memory
+static_assert(sizeof(bvhNode) == 48, "layout of bvhNode changed, bump meshCacheVersion");
+
+static uint64_t alignUp(uint64_t value) {
+	return (value + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+}
+
+std::string meshCachePath(const std::string& sourceFile) {
+	return sourceFile + ".rmesh";
+}
+
+bool sourceFileInfo(const std::string& filename, uint64_t& size, int64_t& mtime) {
+#ifdef _WIN32
+	struct _stat64 st;
+	if (_stat64(filename.c_str(), &st) != 0) return false;
+#else
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0) return false;
+#endif
+	size = (uint64_t)st.st_size;
+	mtime = (int64_t)st.st_mtime;
+	return true;
+}
+
+// sizes of level arrays as they are stored, absent optional sections are still counted
+static void sectionSizes(const meshCacheLevel& record, uint64_t bytes[SECTION_COUNT]) {
+	for (int s = SECTION_POSITION_X; s <= SECTION_NORMAL_Z; s++) {
+		bytes[s] = record.vertexCount * sizeof(float);
+	}
+	bytes[SECTION_INDICES] = record.indexCount * sizeof(unsigned int);
+	bytes[SECTION_NODES] = record.nodeCount * sizeof(bvhNode);
+	for (int s = SECTION_PACKED_X; s <= SECTION_PACKED_NORMAL_V; s++) {
+		bytes[s] = record.vertexCount * sizeof(unsigned short);
+	}
+	bytes[SECTION_PACKED_INDICES] = (record.indexCount - record.wideCount) * sizeof(unsigned short);
+	bytes[SECTION_INDEX_BASES] = record.baseCount * sizeof(unsigned int);
+	bytes[SECTION_WIDE_INDICES] = record.wideCount * sizeof(unsigned int);
+	bytes[SECTION_INDEX_OFFSETS] = record.baseCount * sizeof(unsigned int);
+}
+
+bool saveMeshCache(const meshAsset& asset, const meshCacheOptions& options, const std::string& filename, uint64_t sourceSize, int64_t sourceMtime) {
+	PROFILE_ZONE("save mesh cache");
+	meshCacheHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, "RMSH", 4);
+	header.version = meshCacheVersion;
+	header.byteOrderMark = byteOrderMark;
+	header.sectionCount = SECTION_COUNT;
+	header.sourceSize = sourceSize;
+	header.sourceMtime = sourceMtime;
+	header.options = options;
+	header.levelCount = (uint32_t)asset.levels.size();
+
+	// lay out present sections of all levels one after another
+	std::vector<meshCacheLevel> records(asset.levels.size());
+	std::vector<std::vector<const void*>> sectionData(asset.levels.size());
+	uint64_t offset = alignUp(sizeof(header) + records.size() * sizeof(meshCacheLevel));
+	for (size_t l = 0; l < asset.levels.size(); l++) {
+		const meshLod& level = asset.levels[l];
+		const mesh& m = level.geometry;
+		meshCacheLevel& record = records[l];
+		std::memset(&record, 0, sizeof(record));
+		record.vertexCount = m.vertexCount();
+		record.indexCount = m.polyCount() * 3;
+		record.nodeCount = level.hierarchy.nodes.size();
+		record.error = level.error;
+		record.acmrFile = level.hierarchy.acmrFile;
+		record.acmrBefore = level.hierarchy.acmrBefore;
+		record.acmrAfter = level.hierarchy.acmrAfter;
+
+		// compact level is written as it is, float streams of it are empty
+		sectionData[l].assign(SECTION_COUNT, nullptr);
+		std::vector<const void*>& data = sectionData[l];
+		data[SECTION_NODES] = record.nodeCount > 0 ? level.hierarchy.nodes.data() : nullptr;
+		if (m.isCompact()) {
+			record.baseCount = m.indexBases.size();
+			record.wideCount = m.wideIndices.size();
+			for (int a = 0; a < 3; a++) {
+				record.quantizedOffset[a] = m.packedVerts.offset[a];
+				record.quantizedScale[a] = m.packedVerts.scale[a];
+			}
+			data[SECTION_PACKED_X] = m.packedVerts.x.data();
+			data[SECTION_PACKED_Y] = m.packedVerts.y.data();
+			data[SECTION_PACKED_Z] = m.packedVerts.z.data();
+			data[SECTION_PACKED_NORMAL_U] = m.packedNormals.u.data();
+			data[SECTION_PACKED_NORMAL_V] = m.packedNormals.v.data();
+			data[SECTION_PACKED_INDICES] = m.packedIndices.empty() ? nullptr : m.packedIndices.data();
+			data[SECTION_INDEX_BASES] = m.indexBases.data();
+			data[SECTION_WIDE_INDICES] = record.wideCount > 0 ? m.wideIndices.data() : nullptr;
+			data[SECTION_INDEX_OFFSETS] = m.indexOffsets.data();
+		}
+		else {
+			bool hasNormals = m.normals.size() == m.verts.size();
+			data[SECTION_POSITION_X] = m.verts.x.data();
+			data[SECTION_POSITION_Y] = m.verts.y.data();
+			data[SECTION_POSITION_Z] = m.verts.z.data();
+			data[SECTION_INDICES] = m.indices.data();
+			if (hasNormals) {
+				data[SECTION_NORMAL_X] = m.normals.x.data();
+				data[SECTION_NORMAL_Y] = m.normals.y.data();
+				data[SECTION_NORMAL_Z] = m.normals.z.data();
+			}
+		}
+		sectionSizes(record, record.sectionBytes);
+		for (int s = 0; s < SECTION_COUNT; s++) {
+			if (sectionData[l][s] == nullptr) {
+				record.sectionBytes[s] = 0;
+				continue;
+			}
+			record.sectionOffset[s] = offset;
+			offset = alignUp(offset + record.sectionBytes[s]);
+		}
+	}
+
+	// write into temporary file first, so readers never see half written cache
+	std::string tempFilename = filename + ".tmp";
+	{
+		std::ofstream f(tempFilename, std::ios::binary | std::ios::trunc);
+		if (!f.is_open()) return false;
+
+		const char padding[sectionAlignment] = { 0 };
+		f.write((const char*)&header, sizeof(header));
+		f.write((const char*)records.data(), records.size() * sizeof(meshCacheLevel));
+		uint64_t written = sizeof(header) + records.size() * sizeof(meshCacheLevel);
+		for (size_t l = 0; l < records.size(); l++) {
+			for (int s = 0; s < SECTION_COUNT; s++) {
+				if (sectionData[l][s] == nullptr) continue;
+				f.write(padding, records[l].sectionOffset[s] - written);
+				f.write((const char*)sectionData[l][s], records[l].sectionBytes[s]);
+				written = records[l].sectionOffset[s] + records[l].sectionBytes[s];
+			}
+		}
+		if (!f.good()) {
+			f.close();
+			std::remove(tempFilename.c_str());
+			return false;
+		}
+	}
+
+	std::remove(filename.c_str());
+	if (std::rename(tempFilename.c_str(), filename.c_str()) != 0) {
+		std::remove(tempFilename.c_str());
+		return false;
+	}
+	return true;
+}
+
+// children come after their parent and ranges stay within the level,
+// so a broken file can not make culling read out of bounds or loop
+static bool validNodes(const bvhNode* nodes, size_t nodeCount, size_t polyCount, size_t vertexCount) {
+	for (size_t n = 0; n < nodeCount; n++) {
+		const bvhNode& node = nodes[n];
+		if (node.polys.first > node.polys.last || node.polys.last > polyCount ||
+			node.verts.first > node.verts.last || node.verts.last > vertexCount) {
+			return false;
+		}
+		bool leaf = node.left < 0 && node.right < 0;
+		bool inner = node.left > (int)n && node.right > (int)n && (size_t)node.left < nodeCount && (size_t)node.right < nodeCount;
+		if (!leaf && !inner) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// float level: indices have to address existing vertices
+static bool loadFloatLevel(const meshCacheLevel& record, const char* const section[SECTION_COUNT], mesh& m) {
+	if (!section[SECTION_POSITION_X] || !section[SECTION_POSITION_Y] || !section[SECTION_POSITION_Z] || !section[SECTION_INDICES]) {
+		return false;
+	}
+
+	// mapped arrays are already in memory layout of mesh, no parsing is needed
+	size_t nVerts = (size_t)record.vertexCount;
+	size_t nIndices = (size_t)record.indexCount;
+	const unsigned int* indices = (const unsigned int*)section[SECTION_INDICES];
+	for (size_t i = 0; i < nIndices; i++) {
+		if (indices[i] >= nVerts) return false;
+	}
+
+	const float* x = (const float*)section[SECTION_POSITION_X];
+	const float* y = (const float*)section[SECTION_POSITION_Y];
+	const float* z = (const float*)section[SECTION_POSITION_Z];
+	m.verts.x.assign(x, x + nVerts);
+	m.verts.y.assign(y, y + nVerts);
+	m.verts.z.assign(z, z + nVerts);
+	m.indices.assign(indices, indices + nIndices);
+
+	// files written without normals get them computed, same as obj files
+	if (section[SECTION_NORMAL_X] && section[SECTION_NORMAL_Y] && section[SECTION_NORMAL_Z]) {
+		const float* nx = (const float*)section[SECTION_NORMAL_X];
+		const float* ny = (const float*)section[SECTION_NORMAL_Y];
+		const float* nz = (const float*)section[SECTION_NORMAL_Z];
+		m.normals.x.assign(nx, nx + nVerts);
+		m.normals.y.assign(ny, ny + nVerts);
+		m.normals.z.assign(nz, nz + nVerts);
+	}
+	else {
+		m.computeNormals();
+	}
+	return true;
+}
+
+// compact level: every block has to stay within its index array, and its indices within vertices
+static bool loadCompactLevel(const meshCacheLevel& record, const char* const section[SECTION_COUNT], mesh& m) {
+	for (int s = SECTION_PACKED_X; s <= SECTION_PACKED_NORMAL_V; s++) {
+		if (!section[s]) return false;
+	}
+	if (!section[SECTION_INDEX_BASES] || !section[SECTION_INDEX_OFFSETS]) {
+		return false;
+	}
+	size_t nVerts = (size_t)record.vertexCount;
+	size_t nIndices = (size_t)record.indexCount;
+	size_t nPolys = nIndices / 3;
+	size_t nWide = (size_t)record.wideCount;
+	if (nVerts == 0 || nWide > nIndices || record.baseCount != (nPolys + indexBlockPolys - 1) / indexBlockPolys) {
+		return false;
+	}
+	size_t nPacked = nIndices - nWide;
+	if ((nPacked > 0) != (section[SECTION_PACKED_INDICES] != nullptr) || (nWide > 0) != (section[SECTION_WIDE_INDICES] != nullptr)) {
+		return false;
+	}
+
+	const unsigned short* packed = (const unsigned short*)section[SECTION_PACKED_INDICES];
+	const unsigned int* bases = (const unsigned int*)section[SECTION_INDEX_BASES];
+	const unsigned int* offsets = (const unsigned int*)section[SECTION_INDEX_OFFSETS];
+	const unsigned int* wide = (const unsigned int*)section[SECTION_WIDE_INDICES];
+	for (size_t b = 0; b < record.baseCount; b++) {
+		size_t count = (std::min(nPolys, (b + 1) * indexBlockPolys) - b * indexBlockPolys) * 3;
+		size_t offset = offsets[b];
+		if (bases[b] == wideIndexBlock) {
+			if (offset > nWide || count > nWide - offset) return false;
+			for (size_t i = 0; i < count; i++) {
+				if (wide[offset + i] >= nVerts) return false;
+			}
+			continue;
+		}
+		if (offset > nPacked || count > nPacked - offset) return false;
+		for (size_t i = 0; i < count; i++) {
+			if ((size_t)bases[b] + packed[offset + i] >= nVerts) return false;
+		}
+	}
+
+	const unsigned short* x = (const unsigned short*)section[SECTION_PACKED_X];
+	const unsigned short* y = (const unsigned short*)section[SECTION_PACKED_Y];
+	const unsigned short* z = (const unsigned short*)section[SECTION_PACKED_Z];
+	const short* u = (const short*)section[SECTION_PACKED_NORMAL_U];
+	const short* v = (const short*)section[SECTION_PACKED_NORMAL_V];
+	m.packedVerts.x.assign(x, x + nVerts);
+	m.packedVerts.y.assign(y, y + nVerts);
+	m.packedVerts.z.assign(z, z + nVerts);
+	for (int a = 0; a < 3; a++) {
+		m.packedVerts.offset[a] = record.quantizedOffset[a];
+		m.packedVerts.scale[a] = record.quantizedScale[a];
+	}
+	m.packedNormals.u.assign(u, u + nVerts);
+	m.packedNormals.v.assign(v, v + nVerts);
+	if (nPacked > 0) {
+		m.packedIndices.assign(packed, packed + nPacked);
+	}
+	m.indexBases.assign(bases, bases + record.baseCount);
+	m.indexOffsets.assign(offsets, offsets + record.baseCount);
+	if (nWide > 0) {
+		m.wideIndices.assign(wide, wide + nWide);
+	}
+	return true;
+}
+
+// copy one level out of mapped file, false if its record does not match the file
+static bool loadLevel(const MappedFile& file, const meshCacheLevel& record, meshLod& level) {
+	// every present section has to be aligned and fit into the file
+	uint64_t expectedBytes[SECTION_COUNT];
+	sectionSizes(record, expectedBytes);
+	const char* section[SECTION_COUNT] = { nullptr };
+	for (int s = 0; s < SECTION_COUNT; s++) {
+		if (record.sectionOffset[s] == 0) continue;
+		if (record.sectionBytes[s] != expectedBytes[s] ||
+			record.sectionOffset[s] % sectionAlignment != 0 ||
+			record.sectionOffset[s] > file.size() ||
+			record.sectionBytes[s] > file.size() - record.sectionOffset[s]) {
+			return false;
+		}
+		section[s] = file.data() + record.sectionOffset[s];
+	}
+	if (record.indexCount % 3 != 0 || (record.nodeCount > 0) != (section[SECTION_NODES] != nullptr)) {
+		return false;
+	}
+	const bvhNode* nodes = (const bvhNode*)section[SECTION_NODES];
+	if (!validNodes(nodes, (size_t)record.nodeCount, (size_t)record.indexCount / 3, (size_t)record.vertexCount)) {
+		return false;
+	}
+
+	bool loaded = section[SECTION_PACKED_X] ? loadCompactLevel(record, section, level.geometry) : loadFloatLevel(record, section, level.geometry);
+	if (!loaded) {
+		return false;
+	}
+	level.hierarchy.nodes.assign(nodes, nodes + record.nodeCount);
+	level.hierarchy.acmrFile = record.acmrFile;
+	level.hierarchy.acmrBefore = record.acmrBefore;
+	level.hierarchy.acmrAfter = record.acmrAfter;
+	level.error = record.error;
+	return true;
+}
+
+bool loadMeshCache(meshAsset& asset, const meshCacheOptions& options, const std::string& filename, uint64_t sourceSize, int64_t sourceMtime) {
+	PROFILE_ZONE("load mesh cache");
+	auto startTime = std::chrono::high_resolution_clock::now();
+	MappedFile file;
+	if (!file.open(filename)) return false;
+	if (file.size() < sizeof(meshCacheHeader)) return false;
+
+	meshCacheHeader header;
+	std::memcpy(&header, file.data(), sizeof(header));
+	if (std::memcmp(header.magic, "RMSH", 4) != 0 ||
+		header.version != meshCacheVersion ||
+		header.byteOrderMark != byteOrderMark ||
+		header.sectionCount != SECTION_COUNT ||
+		std::memcmp(&header.options, &options, sizeof(options)) != 0) {
+		return false;
+	}
+	if (sourceSize != 0 && (header.sourceSize != sourceSize || header.sourceMtime != sourceMtime)) {
+		return false;
+	}
+	if (header.levelCount == 0 || header.levelCount > (file.size() - sizeof(header)) / sizeof(meshCacheLevel)) {
+		return false;
+	}
+
+	std::vector<meshCacheLevel> records(header.levelCount);
+	std::memcpy(records.data(), file.data() + sizeof(header), records.size() * sizeof(meshCacheLevel));
+	std::vector<meshLod> levels(records.size());
+	for (size_t l = 0; l < records.size(); l++) {
+		levels[l].hierarchy.leafSize = options.leafSize;
+		levels[l].hierarchy.vertexCacheOrder = options.vertexCacheOrder != 0;
+		if (!loadLevel(file, records[l], levels[l])) {
+			return false;
+		}
+	}
+	asset.levels = std::move(levels);
+
+	auto elapsed = std::chrono::high_resolution_clock::now() - startTime;
+	loadStats& stats = asset.levels[0].geometry.lastLoad;
+	stats.bytes = file.size();
+	stats.faces = asset.levels[0].geometry.polyCount();
+	stats.seconds = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() / 1e6;
+	stats.fromCache = true;
+	return true;
+}
@@ -0,0 +1,102 @@
+/* Short description: versioned binary mesh format, which is loaded by
+ * memory mapping without any parsing, and used as a cache of obj files
+ */
+
+#pragma once
+
+#include "Util.h"
+
+#include <string>
+#include <cstdint>
+
+class meshAsset;
+
+// arrays of one level stored in binary mesh file, each one starts at 64 byte aligned offset
+enum meshSection
+{
+	SECTION_POSITION_X,		// float[vertexCount]
+	SECTION_POSITION_Y,		// float[vertexCount]
+	SECTION_POSITION_Z,		// float[vertexCount]
+	SECTION_INDICES,		// uint32[indexCount]
+	SECTION_NORMAL_X,		// float[vertexCount], optional
+	SECTION_NORMAL_Y,		// float[vertexCount], optional
+	SECTION_NORMAL_Z,		// float[vertexCount], optional
+	SECTION_NODES,			// bvhNode[nodeCount], optional
+	SECTION_PACKED_X,		// uint16[vertexCount], compact level instead of positions
+	SECTION_PACKED_Y,		// uint16[vertexCount]
+	SECTION_PACKED_Z,		// uint16[vertexCount]
+	SECTION_PACKED_NORMAL_U,	// int16[vertexCount], octahedral normals of compact level
+	SECTION_PACKED_NORMAL_V,	// int16[vertexCount]
+	SECTION_PACKED_INDICES,	// uint16[indexCount - wideCount], offsets from bases of index blocks, optional
+	SECTION_INDEX_BASES,	// uint32[baseCount], mesh::indexBases
+	SECTION_WIDE_INDICES,	// uint32[wideCount], mesh::wideIndices, optional
+	SECTION_INDEX_OFFSETS,	// uint32[baseCount], mesh::indexOffsets
+	SECTION_COUNT
+};
+
+// options levels were built with, file built with other ones is not used
+struct meshCacheOptions
+{
+	uint32_t leafSize;			// bvh::leafSize
+	uint32_t vertexCacheOrder;	// bvh::vertexCacheOrder, 0 or 1
+	uint32_t buildLods;			// scene::buildLods, 0 or 1
+	uint32_t lodMinPolys;		// scene::lodMinPolys
+	uint32_t lodMaxLevels;		// scene::lodMaxLevels
+	uint32_t compactMeshes;		// scene::compactMeshes, 0 or 1
+};
+
+// file starts with this header, all values are little endian
+struct meshCacheHeader
+{
+	char magic[4];							// "RMSH"
+	uint32_t version;						// meshCacheVersion
+	uint32_t byteOrderMark;					// 0x01020304 as written by the host
+	uint32_t sectionCount;					// SECTION_COUNT
+	uint64_t sourceSize;					// size of source obj file, 0 if unknown
+	int64_t sourceMtime;					// modification time of source obj file
+	meshCacheOptions options;
+	uint32_t levelCount;					// meshCacheLevel records right after header
+	uint32_t reserved;
+};
+
+// one level of detail, mesh in the order its hierarchy was built for,
+// in float or in compact form
+struct meshCacheLevel
+{
+	uint64_t vertexCount;
+	uint64_t indexCount;
+	uint64_t nodeCount;
+	uint64_t baseCount;						// blocks of compact indices, 0 for float level
+	uint64_t wideCount;
+	float error;							// meshLod::error
+	float acmrBefore;						// bvh::acmrBefore
+	float acmrAfter;						// bvh::acmrAfter
+	float quantizedOffset[3];				// quantizedStream::offset
+	float quantizedScale[3];				// quantizedStream::scale
+	float acmrFile;							// bvh::acmrFile
+	uint64_t sectionOffset[SECTION_COUNT];	// from file start, 0 if section is absent
+	uint64_t sectionBytes[SECTION_COUNT];
+};
+
+// bumped on every incompatible change of the layout,
+// 2 - obj loader splits vertices by normals and triangulates polygons,
+// 3 - levels are stored after hierarchy build, together with its nodes,
+// 4 - all levels of detail, also in compact form,
+// 5 - compact levels keep 16 bit indices only of blocks which fit, blocks are found by offsets,
+// 6 - vertex cache miss ratio of source order
+const uint32_t meshCacheVersion = 6;
+
+// cache file name for given source file
+std::string meshCachePath(const std::string& sourceFile);
+
+// size and modification time of file, false if it does not exist
+bool sourceFileInfo(const std::string& filename, uint64_t& size, int64_t& mtime);
+
+// write finished levels of asset with their hierarchies in binary format, options they
+// were built with and source size and time are stored for validation
+bool saveMeshCache(const meshAsset& asset, const meshCacheOptions& options, const std::string& filename, uint64_t sourceSize, int64_t sourceMtime);
+
+// load levels of asset from binary file, fills lastLoad of level 0. Fails if file is missing,
+// broken, of other version, built with other options, or was made from a source of
+// different size or time (pass sourceSize 0 to skip the check)
+bool loadMeshCache(meshAsset& asset, const meshCacheOptions& options, const std::string& filename, uint64_t sourceSize, int64_t sourceMtime);
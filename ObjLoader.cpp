@@ -0,0 +1,474 @@
+/* Short description: obj file parser working directly on file contents
+ * in memory, with hand written tokenizer and number parsing,
+ * large files are parsed in chunks on multiple threads
+ */
+
+#include "ObjLoader.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cfloat>
+#include <algorithm>
+#include <unordered_map>
+#include <memory>
+#include <functional>
+
+// powers of 10 exactly representable in double
+static const double exactPowers10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+	1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+static inline bool isSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline const char* skipSpaces(const char* p, const char* end) {
+	while (p < end && isSpace(*p)) p++;
+	return p;
+}
+
+// rare cases (long mantissa, huge exponent, inf, nan) go through C library
+static bool parseFloatSlow(const char*& p, const char* end, float& value) {
+	char buffer[64];
+	size_t length = 0;
+	while (p + length < end && !isSpace(p[length]) && length < sizeof(buffer) - 1) {
+		buffer[length] = p[length];
+		length++;
+	}
+	buffer[length] = '\0';
+
+	char* parsedEnd = nullptr;
+	value = strtof(buffer, &parsedEnd);
+	if (parsedEnd == buffer) return false;
+	p += parsedEnd - buffer;
+	return true;
+}
+
+bool parseFloat(const char*& p, const char* end, float& value) {
+	const char* s = p;
+	bool negative = false;
+	if (s < end && (*s == '-' || *s == '+')) {
+		negative = *s == '-';
+		s++;
+	}
+
+	// up to 19 significant digits fit into 64 bit mantissa
+	uint64_t mantissa = 0;
+	int significant = 0;
+	int exponent = 0;
+	bool anyDigits = false;
+	bool truncated = false;
+
+	while (s < end && isDigit(*s)) {
+		if (significant < 19) {
+			mantissa = mantissa * 10 + (*s - '0');
+			if (mantissa != 0) significant++;
+		}
+		else {
+			exponent++;
+			truncated = true;
+		}
+		anyDigits = true;
+		s++;
+	}
+	if (s < end && *s == '.') {
+		s++;
+		while (s < end && isDigit(*s)) {
+			if (significant < 19) {
+				mantissa = mantissa * 10 + (*s - '0');
+				if (mantissa != 0) significant++;
+				exponent--;
+			}
+			else {
+				truncated = true;
+			}
+			anyDigits = true;
+			s++;
+		}
+	}
+	if (!anyDigits) {
+		return parseFloatSlow(p, end, value);
+	}
+
+	// exponent is part of number only if digits follow
+	if (s < end && (*s == 'e' || *s == 'E')) {
+		const char* e = s + 1;
+		bool negativeExp = false;
+		if (e < end && (*e == '-' || *e == '+')) {
+			negativeExp = *e == '-';
+			e++;
+		}
+		if (e < end && isDigit(*e)) {
+			int expValue = 0;
+			while (e < end && isDigit(*e)) {
+				if (expValue < 10000) expValue = expValue * 10 + (*e - '0');
+				e++;
+			}
+			exponent += negativeExp ? -expValue : expValue;
+			s = e;
+		}
+	}
+
+	if (mantissa == 0) {
+		value = negative ? -0.0f : 0.0f;
+		p = s;
+		return true;
+	}
+
+	// mantissa and power of 10 are exact in double, so is the division / multiplication result
+	if (truncated || mantissa > (1ull << 53) || exponent < -22 || exponent > 22) {
+		return parseFloatSlow(p, end, value);
+	}
+	double d = (double)mantissa;
+	d = exponent < 0 ? d / exactPowers10[-exponent] : d * exactPowers10[exponent];
+
+	// rounding double to float is wrong only when double lands exactly half way
+	// between two floats, or when result is not a normal float
+	uint64_t bits;
+	std::memcpy(&bits, &d, sizeof(bits));
+	if ((bits & 0x1FFFFFFFull) == 0x10000000ull || d < FLT_MIN || d > FLT_MAX) {
+		return parseFloatSlow(p, end, value);
+	}
+
+	value = negative ? -(float)d : (float)d;
+	p = s;
+	return true;
+}
+
+bool parseInt(const char*& p, const char* end, int& value) {
+	const char* s = p;
+	bool negative = false;
+	if (s < end && (*s == '-' || *s == '+')) {
+		negative = *s == '-';
+		s++;
+	}
+	if (s >= end || !isDigit(*s)) return false;
+
+	long long result = 0;
+	while (s < end && isDigit(*s)) {
+		if (result < 0x7FFFFFFF) result = result * 10 + (*s - '0');
+		s++;
+	}
+	if (result > 0x7FFFFFFF) result = 0x7FFFFFFF;
+	value = (int)(negative ? -result : result);
+	p = s;
+	return true;
+}
+
+// obj indexes positions and normals separately, mesh vertex is a unique pair of them.
+// refNormals holds normal of every index in out.indices, -1 if polygon gave none
+static void buildNormalVertices(const vertexStream& fileNormals, const std::vector<int>& refNormals, mesh& out) {
+	// same normal is often written many times, pairs are made of first copy
+	size_t nNormals = fileNormals.size();
+	std::vector<unsigned int> order(nNormals);
+	for (size_t n = 0; n < nNormals; n++) order[n] = (unsigned int)n;
+	std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+		if (fileNormals.x[a] != fileNormals.x[b]) return fileNormals.x[a] < fileNormals.x[b];
+		if (fileNormals.y[a] != fileNormals.y[b]) return fileNormals.y[a] < fileNormals.y[b];
+		return fileNormals.z[a] < fileNormals.z[b];
+	});
+	std::vector<unsigned int> canonical(nNormals);
+	for (size_t i = 0; i < nNormals; i++) {
+		unsigned int n = order[i], prev = i > 0 ? canonical[order[i - 1]] : n;
+		bool same = i > 0 && fileNormals.x[n] == fileNormals.x[prev] && fileNormals.y[n] == fileNormals.y[prev] && fileNormals.z[n] == fileNormals.z[prev];
+		canonical[n] = same ? prev : n;
+	}
+
+	vertexStream positions = std::move(out.verts);
+	out.verts.clear();
+	out.normals.clear();
+	std::unordered_map<uint64_t, unsigned int> pairs;
+	std::vector<unsigned int> missing;
+	for (size_t i = 0; i < out.indices.size(); i++) {
+		unsigned int v = out.indices[i];
+		int n = refNormals[i] < 0 ? -1 : (int)canonical[refNormals[i]];
+		uint64_t key = ((uint64_t)v << 32) | (uint32_t)(n + 1);
+		auto it = pairs.find(key);
+		if (it == pairs.end()) {
+			unsigned int vertex = (unsigned int)out.verts.size();
+			it = pairs.emplace(key, vertex).first;
+			out.verts.push_back(positions.get(v));
+			if (n < 0) {
+				out.normals.push_back(vec4(0.0f, 0.0f, 0.0f));
+				missing.push_back(vertex);
+			}
+			else {
+				// exported normals are not always of unit length
+				vec4 normal = fileNormals.get(n);
+				float length = normal.length();
+				out.normals.push_back(length > 0.0f ? normal / length : vec4(0.0f, 0.0f, 0.0f));
+			}
+		}
+		out.indices[i] = it->second;
+	}
+	if (missing.empty()) {
+		return;
+	}
+
+	// polygons without normals in file with normals, their vertices get smooth normals
+	vertexStream sums;
+	sums.resize(out.verts.size());
+	for (size_t f = 0; f < out.polyCount(); f++) {
+		const unsigned int* idx = &out.indices[f * 3];
+		vec4 p0 = out.verts.get(idx[0]);
+		vec4 line1 = out.verts.get(idx[1]) - p0;
+		vec4 line2 = out.verts.get(idx[2]) - p0;
+		vec4 normal = line1.cross(line2);
+		for (int k = 0; k < 3; k++) {
+			sums.x[idx[k]] += normal.x;
+			sums.y[idx[k]] += normal.y;
+			sums.z[idx[k]] += normal.z;
+		}
+	}
+	for (unsigned int v : missing) {
+		vec4 sum = sums.get(v);
+		float length = sum.length();
+		if (length > 0.0f) {
+			vec4 normal = sum / length;
+			out.normals.x[v] = normal.x;
+			out.normals.y[v] = normal.y;
+			out.normals.z[v] = normal.z;
+		}
+	}
+}
+
+// resolve 1-based obj index, negative ones count back from the last element read so far,
+// returns 0-based index or -1 if it is out of range
+static int resolveIndex(int index, size_t count) {
+	long long resolved = index < 0 ? (long long)count + index : (long long)index - 1;
+	return resolved >= 0 && resolved < (long long)count ? (int)resolved : -1;
+}
+
+// part of obj text parsed on its own. Polygon references are kept as written in file,
+// they are resolved once counts of vertices and normals in previous parts are known
+struct objChunk
+{
+	const char* begin = nullptr;
+	const char* end = nullptr;
+	vertexStream verts;
+	vertexStream normals;
+	std::vector<int> refVerts;			// references of all polygons as written in file
+	std::vector<int> refNormals;		// 0 - reference has no normal
+	std::vector<unsigned int> faceStart;	// first reference of every polygon, one more at the end
+	std::vector<unsigned int> faceVerts;	// vertices read in this part before polygon
+	std::vector<unsigned int> faceNormals;	// normals read in this part before polygon
+	size_t triangles = 0;
+	const char* error = nullptr;		// first error, parsing stops there
+};
+
+static void parseChunk(objChunk& chunk) {
+	PROFILE_ZONE("parse obj chunk");
+	const char* end = chunk.end;
+	const char* line = chunk.begin;
+	chunk.faceStart.push_back(0);
+	while (line < end) {
+		const char* lineEnd = (const char*)std::memchr(line, '\n', end - line);
+		if (lineEnd == nullptr) lineEnd = end;
+		const char* p = line;
+		line = lineEnd + 1;
+
+		if (lineEnd - p < 3) {
+			continue;
+		}
+
+		// line header
+		p = skipSpaces(p, lineEnd);
+		const char* header = p;
+		while (p < lineEnd && !isSpace(*p)) p++;
+		size_t headerLength = p - header;
+
+		if (headerLength == 2 && header[0] == 'v' && header[1] == 'n') {
+			float n[3];
+			for (int i = 0; i < 3; i++) {
+				p = skipSpaces(p, lineEnd);
+				if (!parseFloat(p, lineEnd, n[i])) {
+					chunk.error = "normal";
+					return;
+				}
+			}
+			chunk.normals.push_back(vec4(n[0], n[1], n[2]));
+			continue;
+		}
+		if (headerLength != 1) {
+			// comments, texture coordinates, groups...
+			continue;
+		}
+
+		if (*header == 'v') {
+			float v[3];
+			for (int i = 0; i < 3; i++) {
+				p = skipSpaces(p, lineEnd);
+				if (!parseFloat(p, lineEnd, v[i])) {
+					chunk.error = "vertex";
+					return;
+				}
+			}
+			chunk.verts.push_back(vec4(v[0], v[1], v[2]));
+		}
+		else if (*header == 'f') {
+			// vertex references in form v, v/t, v//n or v/t/n, texture coordinates are not used
+			size_t first = chunk.refVerts.size();
+			p = skipSpaces(p, lineEnd);
+			while (p < lineEnd) {
+				int index, texture, normal = 0;
+				if (!parseInt(p, lineEnd, index)) {
+					chunk.error = "polygon";
+					return;
+				}
+				if (p < lineEnd && *p == '/') {
+					p++;
+					parseInt(p, lineEnd, texture);
+					if (p < lineEnd && *p == '/') {
+						p++;
+						parseInt(p, lineEnd, normal);
+					}
+				}
+				chunk.refVerts.push_back(index);
+				chunk.refNormals.push_back(normal);
+				p = skipSpaces(p, lineEnd);
+			}
+
+			size_t count = chunk.refVerts.size() - first;
+			if (count < 3) {
+				chunk.error = "polygon";
+				return;
+			}
+			chunk.faceStart.push_back((unsigned int)chunk.refVerts.size());
+			chunk.faceVerts.push_back((unsigned int)chunk.verts.size());
+			chunk.faceNormals.push_back((unsigned int)chunk.normals.size());
+			chunk.triangles += count - 2;
+		}
+	}
+}
+
+// resolve references of chunk polygons, with vertices and normals of previous chunks
+// before it, into triangle fans starting at indices and refNormals. Returns true
+// if chunk has a polygon with normals
+static bool resolveChunk(objChunk& chunk, size_t vertsBefore, size_t normalsBefore, unsigned int* indices, int* refNormals) {
+	bool anyNormals = false;
+	size_t corner = 0;
+	for (size_t f = 0; f + 1 < chunk.faceStart.size(); f++) {
+		size_t vertCount = vertsBefore + chunk.faceVerts[f];
+		size_t normalCount = normalsBefore + chunk.faceNormals[f];
+		unsigned int first = chunk.faceStart[f], last = chunk.faceStart[f + 1];
+		for (unsigned int r = first; r < last; r++) {
+			int normal = chunk.refNormals[r];
+			int v = resolveIndex(chunk.refVerts[r], vertCount);
+			int n = normal == 0 ? -1 : resolveIndex(normal, normalCount);
+			if (v < 0 || (normal != 0 && n < 0)) {
+				// it comes before any error found while parsing
+				chunk.error = "polygon index";
+				return anyNormals;
+			}
+			chunk.refVerts[r] = v;
+			chunk.refNormals[r] = n;
+			anyNormals = anyNormals || n >= 0;
+		}
+
+		// polygons with more vertices are split into triangle fan, expected to be convex
+		for (unsigned int k = first + 1; k + 1 < last; k++) {
+			unsigned int fan[3] = { first, k, k + 1 };
+			for (unsigned int r : fan) {
+				indices[corner] = (unsigned int)chunk.refVerts[r];
+				refNormals[corner] = chunk.refNormals[r];
+				corner++;
+			}
+		}
+	}
+	return anyNormals;
+}
+
+static void appendStream(const vertexStream& from, vertexStream& to, size_t offset) {
+	std::copy(from.x.begin(), from.x.end(), to.x.begin() + offset);
+	std::copy(from.y.begin(), from.y.end(), to.y.begin() + offset);
+	std::copy(from.z.begin(), from.z.end(), to.z.begin() + offset);
+}
+
+bool parseObj(const char* begin, const char* end, mesh& out, int threadCount, size_t chunkSize) {
+	PROFILE_ZONE("parse obj");
+
+	// chunks end after a line break, so every line is parsed whole by one of them
+	std::vector<objChunk> chunks;
+	const char* chunkBegin = begin;
+	while (chunkBegin < end) {
+		const char* chunkEnd = end;
+		if ((size_t)(end - chunkBegin) > chunkSize) {
+			const char* lineBreak = (const char*)std::memchr(chunkBegin + chunkSize, '\n', end - chunkBegin - chunkSize);
+			chunkEnd = lineBreak == nullptr ? end : lineBreak + 1;
+		}
+		chunks.emplace_back();
+		chunks.back().begin = chunkBegin;
+		chunks.back().end = chunkEnd;
+		chunkBegin = chunkEnd;
+	}
+
+	// small files are not worth starting threads
+	std::unique_ptr<ThreadPool> pool;
+	if (chunks.size() > 1 && threadCount != 1) {
+		pool.reset(new ThreadPool(threadCount));
+	}
+	auto forEachChunk = [&](const std::function<void(size_t index, int worker)>& task) {
+		if (pool) {
+			pool->parallelFor(chunks.size(), task);
+		}
+		else {
+			for (size_t c = 0; c < chunks.size(); c++) task(c, 0);
+		}
+	};
+
+	forEachChunk([&](size_t c, int) {
+		parseChunk(chunks[c]);
+	});
+
+	// prefix sums of counts give position of every chunk in whole file
+	std::vector<size_t> vertsBefore(chunks.size() + 1, 0);
+	std::vector<size_t> normalsBefore(chunks.size() + 1, 0);
+	std::vector<size_t> trianglesBefore(chunks.size() + 1, 0);
+	for (size_t c = 0; c < chunks.size(); c++) {
+		vertsBefore[c + 1] = vertsBefore[c] + chunks[c].verts.size();
+		normalsBefore[c + 1] = normalsBefore[c] + chunks[c].normals.size();
+		trianglesBefore[c + 1] = trianglesBefore[c] + chunks[c].triangles;
+	}
+	vertexStream fileNormals;
+	std::vector<int> refNormals;		// normal of every index, -1 if none
+	out.verts.resize(vertsBefore.back());
+	fileNormals.resize(normalsBefore.back());
+	out.indices.resize(trianglesBefore.back() * 3);
+	refNormals.resize(trianglesBefore.back() * 3);
+	std::vector<unsigned char> chunkNormals(chunks.size(), 0);
+
+	forEachChunk([&](size_t c, int) {
+		objChunk& chunk = chunks[c];
+		appendStream(chunk.verts, out.verts, vertsBefore[c]);
+		appendStream(chunk.normals, fileNormals, normalsBefore[c]);
+		chunkNormals[c] = resolveChunk(chunk, vertsBefore[c], normalsBefore[c],
+			out.indices.data() + trianglesBefore[c] * 3, refNormals.data() + trianglesBefore[c] * 3);
+
+		// parsed data is copied out, only error is kept
+		const char* error = chunk.error;
+		chunk = objChunk();
+		chunk.error = error;
+	});
+
+	// first error in file order is the one sequential parsing would stop at
+	for (const objChunk& chunk : chunks) {
+		if (chunk.error != nullptr) {
+			std::cout << "Reading failed: " << chunk.error << std::endl;
+			return false;
+		}
+	}
+
+	if (std::find(chunkNormals.begin(), chunkNormals.end(), 1) != chunkNormals.end()) {
+		buildNormalVertices(fileNormals, refNormals, out);
+	}
+	return true;
+}
@@ -0,0 +1,26 @@
+/* Short description: obj file parser working directly on file contents
+ * in memory, with hand written tokenizer and number parsing,
+ * large files are parsed in chunks on multiple threads
+ */
+
+#pragma once
+
+#include "Util.h"
+
+// text of one parse task, large files are split into chunks of about this size
+const size_t defaultObjChunkSize = 4 << 20;
+
+// parse obj text [begin, end) into empty out mesh, polygons with more than 3 vertices
+// are triangulated. Normals are filled only if file has them,
+// on error prints reason and returns false.
+// Text is split into chunks at line breaks, parsed on threadCount threads (0 - one
+// per hardware thread), and references are resolved with counts of vertices and normals
+// in previous chunks, so result is the same as parsing the whole file in one pass
+bool parseObj(const char* begin, const char* end, mesh& out, int threadCount = 0, size_t chunkSize = defaultObjChunkSize);
+
+// parse decimal float at p, on success moves p past the number,
+// result is the same as strtof gives
+bool parseFloat(const char*& p, const char* end, float& value);
+
+// parse decimal integer at p, on success moves p past the number
+bool parseInt(const char*& p, const char* end, int& value);
@@ -0,0 +1,249 @@
+/* Short description: hierarchical depth buffer for occlusion culling,
+ * occluders are rasterized into blocks of pixels with coverage masks,
+ * bounds of mesh clusters are tested against its levels
+ */
+
+#include "OcclusionBuffer.h"
+#include "FrameBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+// all 16 pixels of block, bit y * blockSize + x
+static const unsigned int fullMask = 0xFFFF;
+
+// added to occluder depth, so rounding never makes it nearer than
+// depth the frame buffer rasterizer writes
+static const float depthTolerance = 1e-6f;
+
+void OcclusionBuffer::resize(int newWidth, int newHeight) {
+	if (newWidth == width && newHeight == height) {
+		return;
+	}
+	width = newWidth;
+	height = newHeight;
+	blocksX = (width + blockSize - 1) / blockSize;
+	blocksY = (height + blockSize - 1) / blockSize;
+
+	levels.clear();
+	levelWidths.clear();
+	levelHeights.clear();
+	int w = blocksX, h = blocksY;
+	while (true) {
+		levels.emplace_back((size_t)w * h, 1.0f);
+		levelWidths.push_back(w);
+		levelHeights.push_back(h);
+		if (w <= 1 && h <= 1) {
+			break;
+		}
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+	}
+	partMask.assign((size_t)blocksX * blocksY, 0);
+	partDepth.assign((size_t)blocksX * blocksY, 1.0f);
+
+	// pixels beyond the screen are never drawn, so they count as covered
+	lastColumnMask = 0;
+	lastRowMask = 0;
+	for (int i = 0; i < blockSize; i++) {
+		for (int j = 0; j < blockSize; j++) {
+			if ((blocksX - 1) * blockSize + i >= width) lastColumnMask |= 1u << (j * blockSize + i);
+			if ((blocksY - 1) * blockSize + j >= height) lastRowMask |= 1u << (j * blockSize + i);
+		}
+	}
+}
+
+void OcclusionBuffer::clear() {
+	std::fill(levels[0].begin(), levels[0].end(), 1.0f);
+	std::fill(partMask.begin(), partMask.end(), 0);
+}
+
+void OcclusionBuffer::coverBlock(size_t block, unsigned int mask, float depth) {
+	float& full = levels[0][block];
+	if (depth >= full) {
+		// behind occluders which already cover the whole block
+		return;
+	}
+	if (mask == fullMask) {
+		full = depth;
+		return;
+	}
+
+	// partial coverage is collected until it fills the block, it is started again
+	// when it can no longer bring depth of block down
+	unsigned short& part = partMask[block];
+	float& partZ = partDepth[block];
+	if (part == 0 || partZ >= full) {
+		part = (unsigned short)mask;
+		partZ = depth;
+	}
+	else {
+		part |= (unsigned short)mask;
+		partZ = std::max(partZ, depth);
+	}
+	if (part == fullMask) {
+		full = partZ;
+		part = 0;
+	}
+}
+
+void OcclusionBuffer::drawOccluder(const polygon& poly, int firstRow, int lastRow, float minArea) {
+	// the same snapped vertices and fill rule as FrameBuffer::drawTriangle, so occluder
+	// covers exactly the pixels frame buffer draws
+	rasterTriangle tri;
+	if (!tri.setup(poly) || tri.area < minArea) {
+		return;
+	}
+	if (tri.maxX < 0 || tri.maxY < 0 || tri.minX >= width || tri.minY >= height) {
+		return;
+	}
+	int minBX = std::max(tri.minX, 0) / blockSize;
+	int minBY = std::max(std::max(tri.minY, 0) / blockSize, firstRow);
+	int maxBX = std::min(tri.maxX, width - 1) / blockSize;
+	int maxBY = std::min(std::min(tri.maxY, height - 1) / blockSize, lastRow - 1);
+	if (minBX > maxBX || minBY > maxBY) {
+		return;
+	}
+
+	// edge functions relative to the first pixel of block: offsets of all 16 pixels,
+	// and the lowest and highest of them
+	int64_t lowest[3], highest[3];
+	int64_t offsets[3][blockSize * blockSize];
+	const int last = blockSize - 1;
+	for (int e = 0; e < 3; e++) {
+		lowest[e] = std::min<int64_t>(0, tri.stepX[e] * last) + std::min<int64_t>(0, tri.stepY[e] * last);
+		highest[e] = std::max<int64_t>(0, tri.stepX[e] * last) + std::max<int64_t>(0, tri.stepY[e] * last);
+		for (int j = 0; j < blockSize; j++) {
+			for (int i = 0; i < blockSize; i++) {
+				offsets[e][j * blockSize + i] = tri.stepX[e] * i + tri.stepY[e] * j;
+			}
+		}
+	}
+
+	// farthest depth over a block is at one of its corner pixels,
+	// and it can not be farther than the farthest vertex
+	float maxZ = tri.maxZ + depthTolerance;
+	float halfSpan = 0.5f * last;
+	float zSpread = (std::fabs(tri.dzdx) + std::fabs(tri.dzdy)) * halfSpan + depthTolerance;
+
+	for (int by = minBY; by <= maxBY; by++) {
+		int py = by * blockSize;
+		float rowZ = tri.rowDepth(py) + tri.dzdy * halfSpan;
+		for (int bx = minBX; bx <= maxBX; bx++) {
+			// nothing to do behind occluders covering the whole block
+			size_t block = (size_t)by * blocksX + bx;
+			int px = bx * blockSize;
+			float blockZ = std::min(tri.depth(rowZ, px) + tri.dzdx * halfSpan + zSpread, maxZ);
+			if (blockZ >= levels[0][block]) {
+				continue;
+			}
+
+			int64_t w[3];
+			bool outside = false, inside = true;
+			for (int e = 0; e < 3; e++) {
+				w[e] = tri.edge(e, px, py);
+				outside |= w[e] + highest[e] < 0;
+				inside &= w[e] + lowest[e] >= 0;
+			}
+			if (outside) {
+				continue;
+			}
+
+			unsigned int mask = fullMask;
+			if (!inside) {
+				mask = 0;
+				for (int k = 0; k < blockSize * blockSize; k++) {
+					bool covered = ((w[0] + offsets[0][k]) | (w[1] + offsets[1][k]) | (w[2] + offsets[2][k])) >= 0;
+					mask |= (unsigned int)covered << k;
+				}
+				if (mask == 0) {
+					continue;
+				}
+			}
+			if (bx == blocksX - 1) mask |= lastColumnMask;
+			if (by == blocksY - 1) mask |= lastRowMask;
+			coverBlock(block, mask, blockZ);
+		}
+	}
+}
+
+void OcclusionBuffer::buildLevels() {
+	for (size_t l = 1; l < levels.size(); l++) {
+		const std::vector<float>& below = levels[l - 1];
+		int belowWidth = levelWidths[l - 1];
+		int belowHeight = levelHeights[l - 1];
+		std::vector<float>& level = levels[l];
+		for (int y = 0; y < levelHeights[l]; y++) {
+			for (int x = 0; x < levelWidths[l]; x++) {
+				// blocks of odd sized level below have no neighbor on the edge
+				int x1 = std::min(x * 2 + 1, belowWidth - 1);
+				int y1 = std::min(y * 2 + 1, belowHeight - 1);
+				float farthest = std::max(
+					std::max(below[(size_t)y * 2 * belowWidth + x * 2], below[(size_t)y * 2 * belowWidth + x1]),
+					std::max(below[(size_t)y1 * belowWidth + x * 2], below[(size_t)y1 * belowWidth + x1]));
+				level[(size_t)y * levelWidths[l] + x] = farthest;
+			}
+		}
+	}
+}
+
+bool OcclusionBuffer::isOccluded(int minX, int minY, int maxX, int maxY, float minDepth) const {
+	minX = std::max(minX, 0);
+	minY = std::max(minY, 0);
+	maxX = std::min(maxX, width - 1);
+	maxY = std::min(maxY, height - 1);
+	if (minX > maxX || minY > maxY) {
+		return false;
+	}
+
+	// finest level where rectangle takes at most 4 x 4 values
+	int x0 = minX / blockSize, y0 = minY / blockSize;
+	int x1 = maxX / blockSize, y1 = maxY / blockSize;
+	size_t l = 0;
+	while (l + 1 < levels.size() && (x1 - x0 >= 4 || y1 - y0 >= 4)) {
+		x0 >>= 1; y0 >>= 1;
+		x1 >>= 1; y1 >>= 1;
+		l++;
+	}
+
+	const std::vector<float>& level = levels[l];
+	for (int y = y0; y <= y1; y++) {
+		for (int x = x0; x <= x1; x++) {
+			if (level[(size_t)y * levelWidths[l] + x] >= minDepth) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool OcclusionBuffer::isBoxOccluded(const float boundsMin[3], const float boundsMax[3], const mat4x4& matObjectToClip) const {
+	const float(*m)[4] = matObjectToClip.m;
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+	float minDepth = FLT_MAX;
+	for (int corner = 0; corner < 8; corner++) {
+		float x = (corner & 1) ? boundsMax[0] : boundsMin[0];
+		float y = (corner & 2) ? boundsMax[1] : boundsMin[1];
+		float z = (corner & 4) ? boundsMax[2] : boundsMin[2];
+		float cx = x * m[0][0] + y * m[1][0] + z * m[2][0] + m[3][0];
+		float cy = x * m[0][1] + y * m[1][1] + z * m[2][1] + m[3][1];
+		float cz = x * m[0][2] + y * m[1][2] + z * m[2][2] + m[3][2];
+		float cw = x * m[0][3] + y * m[1][3] + z * m[2][3] + m[3][3];
+		if (!(cz > 0.0f && cw > 0.0f)) {
+			return false;
+		}
+
+		// the same viewport mapping as transformVertices
+		float sx = (1.0f - cx / cw) * 0.5f * width;
+		float sy = (1.0f - cy / cw) * 0.5f * height;
+		minX = std::min(minX, sx);
+		maxX = std::max(maxX, sx);
+		minY = std::min(minY, sy);
+		maxY = std::max(maxY, sy);
+		minDepth = std::min(minDepth, cz / cw);
+	}
+
+	// one more pixel around for rounding of vertices
+	return isOccluded((int)std::floor(minX) - 1, (int)std::floor(minY) - 1, (int)std::floor(maxX) + 1, (int)std::floor(maxY) + 1, minDepth);
+}
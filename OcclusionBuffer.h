@@ -0,0 +1,59 @@
+/* Short description: hierarchical depth buffer for occlusion culling,
+ * occluders are rasterized into blocks of pixels with coverage masks,
+ * bounds of mesh clusters are tested against its levels
+ */
+
+#pragma once
+
+#include "Util.h"
+
+#include <vector>
+
+class OcclusionBuffer
+{
+public:
+	// side of pixel block, which gets one depth value, its pixel centers are the samples
+	static const int blockSize = 4;
+
+	int width = 0;		// in pixels
+	int height = 0;
+	int blocksX = 0;
+	int blocksY = 0;
+
+	// farthest depth of every block, 0 - one value per block, every next level halves both sides.
+	// Every pixel of block is covered by an occluder at least this near
+	std::vector<std::vector<float>> levels;
+	std::vector<int> levelWidths;
+	std::vector<int> levelHeights;
+
+	// allocate levels for screen of given size, nothing is done if size is the same
+	void resize(int newWidth, int newHeight);
+
+	// nothing is covered
+	void clear();
+
+	// rasterize screen space polygon into block rows [firstRow, lastRow), bands of rows
+	// can be drawn in parallel. Depth of a block goes down only when occluders drawn so far
+	// cover all its pixels, so the buffer never hides what the frame buffer would show.
+	// Polygons smaller than minArea pixels are skipped, they cost more than they cover
+	void drawOccluder(const polygon& poly, int firstRow, int lastRow, float minArea = 0.0f);
+
+	// fill levels above 0 after occluders are drawn
+	void buildLevels();
+
+	// pixel rectangle (inclusive) with nothing nearer than minDepth is hidden in all its pixels
+	bool isOccluded(int minX, int minY, int maxX, int maxY, float minDepth) const;
+
+	// box in object space, projected with object -> clip transform, is hidden,
+	// boxes crossing the near plane are never hidden
+	bool isBoxOccluded(const float boundsMin[3], const float boundsMax[3], const mat4x4& matObjectToClip) const;
+
+private:
+	std::vector<unsigned short> partMask;	// pixels of block covered by occluders not covering all of it yet
+	std::vector<float> partDepth;			// farthest depth of those occluders
+	unsigned int lastColumnMask = 0;		// pixels of blocks in the last column which are beyond the screen
+	unsigned int lastRowMask = 0;			// same for the last row
+
+	// merge coverage of one occluder into block
+	void coverBlock(size_t block, unsigned int mask, float depth);
+};
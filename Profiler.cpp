@@ -0,0 +1,127 @@
+/* Short description: frame profiler, scoped zones are recorded into
+ * per-thread lock-free ring buffers and exported as Chrome trace
+ */
+
+#include "Profiler.h"
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+
+// rings of every thread which recorded something, kept after threads exit
+class profileRegistry
+{
+public:
+	std::mutex lock;
+	std::vector<std::unique_ptr<profileRing>> rings;
+	std::atomic<bool> enabled{ true };
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+};
+
+static profileRegistry& registry() {
+	static profileRegistry instance;
+	return instance;
+}
+
+static thread_local profileRing* localRing = nullptr;
+
+// names are literals and thread names, only quotes and backslashes need escaping
+static std::string escapeJson(const std::string& s) {
+	std::string out;
+	for (char c : s) {
+		if (c == '"' || c == '\\') out += '\\';
+		out += c;
+	}
+	return out;
+}
+
+void profileRing::push(const char* name, uint64_t start, uint64_t end) {
+	uint64_t index = head.load(std::memory_order_relaxed);
+	profileEvent& e = events[index & (capacity - 1)];
+
+	// sequence is cleared while fields are written, reader skips such events
+	e.sequence.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	e.name.store(name, std::memory_order_relaxed);
+	e.start.store(start, std::memory_order_relaxed);
+	e.end.store(end, std::memory_order_relaxed);
+	e.sequence.store(index + 1, std::memory_order_release);
+	head.store(index + 1, std::memory_order_release);
+}
+
+void Profiler::setEnabled(bool enabled) {
+	registry().enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool Profiler::isEnabled() {
+	return registry().enabled.load(std::memory_order_relaxed);
+}
+
+uint64_t Profiler::now() {
+	auto elapsed = std::chrono::steady_clock::now() - registry().startTime;
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+void Profiler::record(const char* name, uint64_t start, uint64_t end) {
+	if (!isEnabled()) return;
+	threadRing().push(name, start, end);
+}
+
+void Profiler::setThreadName(const std::string& name) {
+	profileRing& ring = threadRing();
+	std::lock_guard<std::mutex> lk(registry().lock);
+	ring.threadName = name;
+}
+
+profileRing& Profiler::threadRing() {
+	if (!localRing) {
+		// first event of this thread, the only time registry is locked while recording
+		profileRegistry& r = registry();
+		std::lock_guard<std::mutex> lk(r.lock);
+		r.rings.emplace_back(new profileRing());
+		localRing = r.rings.back().get();
+		localRing->threadId = (int)r.rings.size();
+		localRing->threadName = "thread " + std::to_string(localRing->threadId);
+	}
+	return *localRing;
+}
+
+bool Profiler::writeChromeTrace(const std::string& filename) {
+	std::ofstream f(filename);
+	if (!f.is_open()) return false;
+
+	profileRegistry& r = registry();
+	std::lock_guard<std::mutex> lk(r.lock);
+
+	f << std::fixed << std::setprecision(3);
+	f << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" << std::endl;
+	bool first = true;
+	for (const auto& ring : r.rings) {
+		f << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring->threadId
+			<< ",\"args\":{\"name\":\"" << escapeJson(ring->threadName) << "\"}}";
+		first = false;
+
+		// events still in the ring, owner thread may be overwriting oldest of them
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		uint64_t begin = head > profileRing::capacity ? head - profileRing::capacity : 0;
+		for (uint64_t i = begin; i < head; i++) {
+			const profileEvent& e = ring->events[i & (profileRing::capacity - 1)];
+			uint64_t sequence = e.sequence.load(std::memory_order_acquire);
+			const char* name = e.name.load(std::memory_order_relaxed);
+			uint64_t start = e.start.load(std::memory_order_relaxed);
+			uint64_t end = e.end.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (sequence != i + 1 || e.sequence.load(std::memory_order_relaxed) != sequence) {
+				continue;
+			}
+
+			// timestamps are in microseconds
+			f << ",\n{\"name\":\"" << escapeJson(name) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring->threadId
+				<< ",\"ts\":" << start / 1000.0 << ",\"dur\":" << (end - start) / 1000.0 << "}";
+		}
+	}
+	f << std::endl << "]}" << std::endl;
+	return f.good();
+}
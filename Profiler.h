@@ -0,0 +1,94 @@
+/* Short description: frame profiler, scoped zones are recorded into
+ * per-thread lock-free ring buffers and exported as Chrome trace
+ */
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <memory>
+#include <cstdint>
+
+// zones are compiled in unless built with RENDER_PROFILER=0
+#ifndef RENDER_PROFILER
+#define RENDER_PROFILER 1
+#endif
+
+// one finished zone, fields are atomic so dump may run while owner thread writes
+class profileEvent
+{
+public:
+	std::atomic<const char*> name{ nullptr };
+	std::atomic<uint64_t> start{ 0 };		// nanoseconds since profiler start
+	std::atomic<uint64_t> end{ 0 };
+	std::atomic<uint64_t> sequence{ 0 };	// number of event + 1 once written, 0 while writing
+};
+
+// last events of one thread, written only by that thread, oldest are overwritten
+class profileRing
+{
+public:
+	static const size_t capacity = 1 << 16;
+
+	int threadId = 0;
+	std::string threadName;			// set once, guarded by profiler registry lock
+	std::atomic<uint64_t> head{ 0 };	// events written so far
+	std::unique_ptr<profileEvent[]> events{ new profileEvent[capacity] };
+
+	void push(const char* name, uint64_t start, uint64_t end);
+};
+
+class Profiler
+{
+public:
+	// recording can be paused at runtime, zones then cost one flag check
+	static void setEnabled(bool enabled);
+	static bool isEnabled();
+
+	// nanoseconds since first use of profiler, steady clock
+	static uint64_t now();
+
+	// add zone [start, end) of calling thread, name has to be a string literal
+	static void record(const char* name, uint64_t start, uint64_t end);
+
+	// name of calling thread in exported trace
+	static void setThreadName(const std::string& name);
+
+	// write events of all threads as Chrome trace event JSON (chrome://tracing, Perfetto)
+	static bool writeChromeTrace(const std::string& filename);
+
+private:
+	static profileRing& threadRing();
+};
+
+// measures time from construction to end of scope
+class profileZone
+{
+public:
+	explicit profileZone(const char* name) : name(name), active(Profiler::isEnabled()), start(active ? Profiler::now() : 0) {}
+	~profileZone() {
+		if (active) {
+			Profiler::record(name, start, Profiler::now());
+		}
+	}
+
+	profileZone(const profileZone&) = delete;
+	profileZone& operator=(const profileZone&) = delete;
+
+private:
+	const char* name;
+	bool active;
+	uint64_t start;
+};
+
+#if RENDER_PROFILER
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+#define PROFILE_ZONE(name) profileZone PROFILE_CONCAT(profileZone_, __LINE__)(name)
+#define PROFILE_EVENT(name, start, end) Profiler::record(name, start, end)
+#define PROFILE_THREAD(name) Profiler::setThreadName(name)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_EVENT(name, start, end) ((void)0)
+#define PROFILE_THREAD(name) ((void)0)
+#endif
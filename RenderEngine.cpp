@@ -5,45 +5,212 @@
  */
 
 #include "RenderEngine.h"
+#include "Clipper.h"
 
 #include <iostream>
 #include <algorithm>
-#include <chrono>
-#include <list>
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+
+// cut ranges of instance into pieces of at most chunkSize elements
+static void splitRanges(unsigned int instance, const std::vector<meshRange>& ranges, size_t chunkSize, arenaVector<instanceRange>& pieces) {
+	for (const meshRange& range : ranges) {
+		for (size_t first = range.first; first < range.last; first += chunkSize) {
+			instanceRange piece;
+			piece.instance = instance;
+			piece.range.first = (unsigned int)first;
+			piece.range.last = (unsigned int)std::min(first + chunkSize, (size_t)range.last);
+			pieces.push_back(piece);
+		}
+	}
+}
+
+// join consecutive pieces into tasks of at most chunkSize elements,
+// so small instances share a task instead of getting one each
+static void groupTasks(const arenaVector<instanceRange>& pieces, size_t chunkSize, arenaVector<meshRange>& tasks) {
+	tasks.clear();
+	size_t taskSize = 0;
+	for (size_t i = 0; i < pieces.size(); i++) {
+		size_t pieceSize = pieces[i].range.last - pieces[i].range.first;
+		if (tasks.empty() || taskSize + pieceSize > chunkSize) {
+			tasks.push_back({ (unsigned int)i, (unsigned int)i + 1 });
+			taskSize = pieceSize;
+		}
+		else {
+			tasks.back().last = (unsigned int)i + 1;
+			taskSize += pieceSize;
+		}
+	}
+}
+
+// light of surfaces facing away from light source
+static const float ambientLight = 0.05f;
+
+// direction towards light in object space of instance. Normals are turned into world
+// by inverse transpose of world matrix, so instead of turning every normal, light is
+// turned back once: its component along object axis i is dot product with cofactor row i
+// (cross product of the other two rows of world matrix) divided by determinant.
+// Result is normalized, so light of unit normal stays in [-1, 1] also for sheared
+// or non-uniformly scaled instances
+static vec4 objectLightDirection(const mat4x4& matWorld) {
+	vec4 light_direction = vec4(0.0f, 1.0f, -1.0f).normalize();
+	vec4 rows[3];
+	for (int r = 0; r < 3; r++) {
+		rows[r] = { matWorld.m[r][0], matWorld.m[r][1], matWorld.m[r][2] };
+	}
+	vec4 cofactors[3] = { rows[1].cross(rows[2]), rows[2].cross(rows[0]), rows[0].cross(rows[1]) };
+	float det = rows[0].dot(cofactors[0]);
+	if (det == 0.0f) {
+		return { 0.0f, 0.0f, 0.0f };
+	}
+	// only sign of determinant matters after normalization, mirrored instances flip the light
+	vec4 d = { cofactors[0].dot(light_direction), cofactors[1].dot(light_direction), cofactors[2].dot(light_direction) };
+	float length = d.length();
+	if (length == 0.0f) {
+		return { 0.0f, 0.0f, 0.0f };
+	}
+	return d * ((det > 0.0f ? 1.0f : -1.0f) / length);
+}
+
+// hierarchy leaf of visible instance, waiting for occlusion test
+struct leafReference
+{
+	unsigned int instance = 0;	// index in scene instances
+	unsigned int visible = 0;	// index in visible instances
+	unsigned int leaf = 0;		// node index in hierarchy of instance level
+};
+
+// polygons of one binning chunk sorted by screen tiles, arrays are in arena of worker
+struct tileBinning
+{
+	const unsigned int* start = nullptr;	// first entry of every tile in indices, nTiles + 1 values
+	const unsigned int* indices = nullptr;	// polygon indices
+};
+
+RenderEngine::RenderEngine(const bool headless) : headless(headless) {
+	frameBuffer.resize(windowWidth, windowHeight);
+	if (headless) {
+		return;
+	}
 
-RenderEngine::RenderEngine() {
 	// add minimum antialiasing
 	sf::ContextSettings settings;
 	settings.antialiasingLevel = 2;
 
 	window.create(sf::VideoMode(windowWidth, windowHeight), "SFML shapes", sf::Style::Default, settings);
+
+	// texture frame buffer is blitted through
+	frameTexture.create(windowWidth, windowHeight);
+	frameSprite.setTexture(frameTexture, true);
+}
+
+RenderEngine::~RenderEngine() {
+	stopPipeline();
+}
+
+bool RenderEngine::load(const std::string& filename) {
+	PROFILE_ZONE("load");
+
+	// load object file as the only object of scene
+	objectScene.clear();
+	invalidateFrame();
+	int asset = objectScene.loadAsset(filename, useMeshCache);
+	if (asset < 0) {
+		return false;
+	}
+
+	// world translation (so camera won't stuck in smaller objects)
+	objectScene.addInstance(asset, mat4x4::makeTranslation(0.0f, 0.0f, 5.0f));
+
+	// fill projection matrix
+	matProj = mat4x4::createProjection(90.0f, (float)windowHeight / (float)windowWidth, 0.1f, 1000.0f);
+	return true;
 }
 
 void RenderEngine::run(const std::string& filename, const bool toRotate) {
-	// load object file
-	if (!objectMesh.loadObjectFile(filename)) {
+	PROFILE_THREAD("main");
+	if (!load(filename)) {
 		std::cout << "Error openning file " << std::endl;
 		exit(1);
 	}
 
-	// fill projection matrix
-	matProj = mat4x4::createProjection(90.0f, (float)windowHeight / (float)windowWidth, 0.1f, 1000.0f);
+	const meshLod& loadedLevel = objectScene.assets[0]->levels[0];
+	const mesh& loadedMesh = loadedLevel.geometry;
+	std::cout << "Loaded " << filename << (loadedMesh.lastLoad.fromCache ? " (cache)" : "") << ": " << loadedMesh.polyCount() << " polygons, "
+		<< loadedMesh.lastLoad.megabytesPerSecond() << " MB/s, "
+		<< loadedMesh.lastLoad.facesPerSecond() << " faces/s, ACMR file " << loadedLevel.hierarchy.acmrFile << ", leaves "
+		<< loadedLevel.hierarchy.acmrBefore << " -> " << loadedLevel.hierarchy.acmrAfter << std::endl;
 
-	// frame time measurment
-	auto start_time = std::chrono::high_resolution_clock::now();
+	// no window and no input, render requested frames into memory
+	if (headless) {
+		float rotationStep = 2.5e-4f * (1000.0f / std::max(1, maxFrameRate));
+		if (pipelined && headlessFrames > 0) {
+			// geometry of frame i + 1 is queued before frame i is drawn
+			startPipeline();
+			fTheta += toRotate ? rotationStep : 0.0f;
+			queueFrame();
+			for (int i = 0; i < headlessFrames; i++) {
+				PROFILE_ZONE("frame");
+				if (i + 1 < headlessFrames) {
+					fTheta += toRotate ? rotationStep : 0.0f;
+					queueFrame();
+				}
+				drawQueuedFrame();
+			}
+			stopPipeline();
+		}
+		else {
+			for (int i = 0; i < headlessFrames; i++) {
+				PROFILE_ZONE("frame");
+				if (toRotate) {
+					fTheta += rotationStep;
+				}
+				render(frameTime);
+			}
+		}
+		if (traceOnExit) {
+			Profiler::writeChromeTrace(traceFile);
+		}
+		return;
+	}
+
+	// display refresh paces frames with vsync, otherwise deadlines of frame pacer
+	window.setVerticalSyncEnabled(verticalSync);
+	framePacer.frameRate = verticalSync ? 0 : maxFrameRate;
+	framePacer.spinMs = spinMs;
+	framePacer.start();
+
+	// first frame goes into pipeline before any input, every loop queues the next one
+	FramePacer::clock::time_point queuedInput = FramePacer::clock::now();
+	if (pipelined) {
+		startPipeline();
+		queueFrame();
+	}
 
 	while (window.isOpen()) {
+		PROFILE_ZONE("frame");
 
-		// catch events
+		// catch events, latency of frame is counted from here
+		FramePacer::clock::time_point inputTime = FramePacer::clock::now();
 		sf::Event event;
-		while (window.pollEvent(event)) {
-			if (event.type == sf::Event::Closed) {
-				window.close();
-			}
-			else if (event.type == sf::Event::Resized) {
-				float aspectRatio = (float)windowHeight / (float)windowWidth;
-				sf::Vector2u newSize = { event.size.width, (unsigned int)(event.size.width * aspectRatio) };
-				window.setSize(newSize);
+		{
+			PROFILE_ZONE("events");
+			while (window.pollEvent(event)) {
+				if (event.type == sf::Event::Closed) {
+					window.close();
+				}
+				else if (event.type == sf::Event::Resized) {
+					float aspectRatio = (float)windowHeight / (float)windowWidth;
+					sf::Vector2u newSize = { event.size.width, (unsigned int)(event.size.width * aspectRatio) };
+					window.setSize(newSize);
+				}
+				else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F12) {
+					// dump last frames to see where slow one went
+					if (Profiler::writeChromeTrace(traceFile)) {
+						std::cout << "Trace written to " << traceFile << std::endl;
+					}
+				}
 			}
 		}
 
@@ -77,181 +244,821 @@ void RenderEngine::run(const std::string& filename, const bool toRotate) {
 			fTheta += 2.5e-4f * frameTime;
 		}
 
-		// clear -> render -> display routine
+		// clear -> render -> display routine, when pipelined geometry of next frame
+		// runs with this input while the previous one is drawn
 		window.clear();
-		render(frameTime);
-		window.display();
+		if (pipelined) {
+			queueFrame();
+			drawQueuedFrame();
+		}
+		else {
+			render(frameTime);
+		}
+		{
+			PROFILE_ZONE("present");
+			if (softwareRaster) {
+				// single upload and draw of whole frame, texture still has unchanged one
+				if (lastFrame.changes != 0) {
+					frameTexture.update(frameBuffer.pixels());
+				}
+				window.draw(frameSprite);
+				drawCalls++;
+			}
+			window.display();
+		}
+
+		// pipelined frame shown now was queued with input of the previous loop
+		if (pipelined) {
+			std::swap(inputTime, queuedInput);
+		}
+		framePacer.framePresented(inputTime);
 
-		// frame time measurment
-		auto elapsed = std::chrono::high_resolution_clock::now() - start_time;
-		float renderTime = (std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()) / 1000.0f;
-		window.setTitle(std::string("Frametime: ").append(std::to_string(frameTime)));
+		// percentiles over the last frames, tail shows jitter which average hides
+		const rollingHistogram& times = framePacer.frameTimes;
+		const rollingHistogram& latency = framePacer.latency;
+		char title[160];
+		snprintf(title, sizeof(title), "Frametime p50/p95/p99: %.1f/%.1f/%.1f ms Latency: %.1f/%.1f/%.1f ms Draw calls: %d",
+			times.percentile(50), times.percentile(95), times.percentile(99),
+			latency.percentile(50), latency.percentile(95), latency.percentile(99), drawCalls);
+		window.setTitle(title);
 
-		// limit framerate to 30
-		if (maxFrameRate > 0) {
-			int sleepTime = 1000.0f / maxFrameRate - (int)renderTime;
-			if (sleepTime < 0) sleepTime = 0;
-			sf::sleep(sf::milliseconds(sleepTime));
+		{
+			PROFILE_ZONE("limiter");
+			framePacer.wait();
 		}
-		
+		frameTime = framePacer.lastFrameTime();
+	}
+	stopPipeline();
 
-		auto elapsed_time = std::chrono::high_resolution_clock::now() - start_time;
-		frameTime = (std::chrono::duration_cast<std::chrono::microseconds>(elapsed_time).count()) / 1000.0f;
-		start_time = std::chrono::high_resolution_clock::now();
+	if (traceOnExit) {
+		Profiler::writeChromeTrace(traceFile);
 	}
 }
 
+void RenderEngine::endStage(frameStats& stats, renderStage stage, uint64_t& stageStart) {
+	uint64_t now = Profiler::now();
+	stats.ms[stage] += (now - stageStart) / 1e6;
+	PROFILE_EVENT(renderStageName(stage), stageStart, now);
+	stageStart = now;
+}
+
 void RenderEngine::render(float fElapsedTime) {
-	// create world tranform matrix
-	mat4x4 matRotY = mat4x4::makeRotationY(fTheta);					// world rotation, better for object exhibition	
-	mat4x4 matTrans = mat4x4::makeTranslation(0.0f, 0.0f, 5.0f);	// world translation (so camera won't stuck in smaller objects)
-	mat4x4 matWorld = matRotY * matTrans; 
+	PROFILE_ZONE("render");
+
+	// geometry stage runs in chunks on worker threads
+	threadPool.resize(threadCount);
+
+	frameSlot& slot = frameSlots[0];
+	slot.params = captureFrame();
+	prepareFrame(slot, threadPool);
+	drawFrame(slot);
+}
+
+frameParams RenderEngine::captureFrame() {
+	// movement of next frame goes along this direction
+	vec4 vForward = { 0, 0, 1 };
+	vLookDir = mat4x4::makeRotationY(fYaw) * vForward;
+
+	frameParams params;
+	params.vCamera = vCamera;
+	params.fYaw = fYaw;
+	params.fTheta = fTheta;
+	return params;
+}
+
+void RenderEngine::prepareFrame(frameSlot& slot, ThreadPool& pool) {
+	PROFILE_ZONE("prepare frame");
+	const frameParams& params = slot.params;
+	vec4 vEye = params.vCamera;			// camera position of this frame
+
+	// every object rotates around its own vertical axis, better for object exhibition
+	mat4x4 matRotY = mat4x4::makeRotationY(params.fTheta);
 
 	// tranformation matrix for camera
 	vec4 vUp = { 0, 1, 0 };
 	vec4 vTarget = { 0, 0, 1 };
 
-	vLookDir = mat4x4::makeRotationY(fYaw) * vTarget;
-	vTarget = vCamera + vLookDir;
-	mat4x4 matCamera = mat4x4::cameraTransform(vCamera, vTarget, vUp);
+	vec4 vDirection = mat4x4::makeRotationY(params.fYaw) * vTarget;
+	vTarget = vEye + vDirection;
+	mat4x4 matCamera = mat4x4::cameraTransform(vEye, vTarget, vUp);
 
 	// create view tranformation
 	mat4x4 matView = matCamera.quickInverse();
 
-	// vector containing all polygons transformed polygons
-	std::vector<polygon> vecPolysToRaster;
-	vecPolysToRaster.reserve(objectMesh.polys.size());
+	// counted again every frame
+	frameStats& stats = slot.stats;
+	stats = frameStats();
+	uint64_t stageStart = Profiler::now();
 
-	// tranform polygons
-	for (polygon& poly : objectMesh.polys) {
-		polygon polyProjected, polyTransformed, polyViewed;
+	// there is nothing to draw SFML shapes into without a window
+	bool rasterOnCPU = softwareRaster || headless;
 
-		// world transform
-		polyTransformed.p[0] = matWorld * poly.p[0];
-		polyTransformed.p[1] = matWorld * poly.p[1];
-		polyTransformed.p[2] = matWorld * poly.p[2];
+	// find what changed since previous frame
+	frameInputs inputs;
+	inputs.matView = matView;
+	inputs.matProj = matProj;
+	inputs.vCamera = vEye;
+	inputs.width = windowWidth;
+	inputs.height = windowHeight;
+	inputs.settings = (backfaceCulling ? 1 : 0) | (frustumCulling ? 2 : 0) | (rasterOnCPU ? 4 : 0)
+		| (batchedSubmission ? 8 : 0) | (wireframe ? 16 : 0) | (depthSort ? 32 : 0) | (occlusionCulling ? 64 : 0);
+	inputs.guardBand = guardBand;
 
-		// calculate normal as cross product of 2 polygon sides
-		vec4 vNormal, line1, line2;
-		line1 = polyTransformed.p[1] - polyTransformed.p[0];
-		line2 = polyTransformed.p[2] - polyTransformed.p[0];
-		vNormal = line1.cross(line2).normalize();
+	unsigned int changes = pendingChanges;
+	pendingChanges = 0;
+	if (memcmp(inputs.matView.m, lastInputs.matView.m, sizeof(inputs.matView.m)) != 0
+		|| inputs.vCamera.x != lastInputs.vCamera.x || inputs.vCamera.y != lastInputs.vCamera.y || inputs.vCamera.z != lastInputs.vCamera.z) {
+		changes |= CHANGED_CAMERA;
+	}
+	if (memcmp(inputs.matProj.m, lastInputs.matProj.m, sizeof(inputs.matProj.m)) != 0) {
+		changes |= CHANGED_PROJECTION;
+	}
+	if (inputs.width != lastInputs.width || inputs.height != lastInputs.height) {
+		changes |= CHANGED_VIEWPORT;
+	}
+	if (inputs.settings != lastInputs.settings || inputs.guardBand != lastInputs.guardBand) {
+		changes |= CHANGED_SETTINGS;
+	}
+	lastInputs = inputs;
 
-		// get camera rey to calculate illumination
-		vec4 vCameraRay = polyTransformed.p[0] - vCamera;
+	// world transform and level of detail of every instance, compared with previous frame
+	if (instanceCaches.size() != objectScene.instances.size()) {
+		instanceCaches.assign(objectScene.instances.size(), instanceCache());
+		changes |= CHANGED_WORLD;
+	}
+	for (size_t i = 0; i < objectScene.instances.size(); i++) {
+		const meshInstance& instance = objectScene.instances[i];
+		const meshAsset& asset = *objectScene.assets[instance.asset];
 
-		// if correct polygon side is visible
-		// if (vNormal.dot(vCameraRay) < 0.0f) {}
-		// illuminate
-		vec4 light_direction = vec4(0.0f, 1.0f, -1.0f).normalize();
+		// matrices are concatenated once per instance, vertices only go through the result
+		mat4x4 matWorld = matRotY * instance.matWorld;
 
-		// calculate illumination by angle between normal and light direction
-		// color is shade of gray, so keep in from 0 to 255
-		unsigned char colorInt;
-		colorInt = std::max(0.05f, light_direction.dot(vNormal)) * 255.0f; 
-		polyTransformed.color = (colorInt << 24) + (colorInt << 16) + (colorInt << 8);
-
-		// tranform from world into view
-		polyViewed.p[0] = matView * polyTransformed.p[0];
-		polyViewed.p[1] = matView * polyTransformed.p[1];
-		polyViewed.p[2] = matView * polyTransformed.p[2];
-		polyViewed.color = polyTransformed.color;
-
-		// polygon clipping agains camera plane
-		int nClippedPolygons = 0;
-		polygon clipped[2];
-		nClippedPolygons = polygon::clipAgainstPlane({ 0.0f, 0.0f, 0.1f }, { 0.0f, 0.0f, 1.0f }, polyViewed, clipped[0], clipped[1]);
-
-		// project results of clipping
-		for (int n = 0; n < nClippedPolygons; n++) {
-			// from view to screen (3D -> 2D)
-			polyProjected.p[0] = matProj * clipped[n].p[0];
-			polyProjected.p[1] = matProj * clipped[n].p[1];
-			polyProjected.p[2] = matProj * clipped[n].p[2];
-			polyProjected.color = clipped[n].color;
-
-			// scaled them into view
-			polyProjected.p[0] = polyProjected.p[0] / polyProjected.p[0].w;
-			polyProjected.p[1] = polyProjected.p[1] / polyProjected.p[1].w;
-			polyProjected.p[2] = polyProjected.p[2] / polyProjected.p[2].w;
-
-			// invert x and y back
-			polyProjected.p[0].x *= -1.0f;
-			polyProjected.p[1].x *= -1.0f;
-			polyProjected.p[2].x *= -1.0f;
-			polyProjected.p[0].y *= -1.0f;
-			polyProjected.p[1].y *= -1.0f;
-			polyProjected.p[2].y *= -1.0f;
-
-			// offset polygon into visible space
-			vec4 vOffsetView = { 1, 1, 0 };
-			polyProjected.p[0] = polyProjected.p[0] + vOffsetView;
-			polyProjected.p[1] = polyProjected.p[1] + vOffsetView;
-			polyProjected.p[2] = polyProjected.p[2] + vOffsetView;
-			polyProjected.p[0].x *= 0.5f * windowWidth;
-			polyProjected.p[0].y *= 0.5f * windowHeight;
-			polyProjected.p[1].x *= 0.5f * windowWidth;
-			polyProjected.p[1].y *= 0.5f * windowHeight;
-			polyProjected.p[2].x *= 0.5f * windowWidth;
-			polyProjected.p[2].y *= 0.5f * windowHeight;
-
-			// push polygons in vector for further sorting
-			vecPolysToRaster.push_back(polyProjected);
-		}
-		// }
-	}
-
-	// sort back to front
-	sort(vecPolysToRaster.begin(), vecPolysToRaster.end(), [](polygon& t1, polygon& t2)
-		{
-			float z1 = (t1.p[0].z + t1.p[1].z + t1.p[2].z) / 3.0f;
-			float z2 = (t2.p[0].z + t2.p[1].z + t2.p[2].z) / 3.0f;
-			return z1 > z2;
-		} );
-
-	// polygon clipping against screen borders
-	for (auto& polyToRaster : vecPolysToRaster) {
-		// clipping agains screen edges may result in a lot of new polygons
-		// so we'll create list to store them
-		polygon clipped[2];
-		std::list<polygon> listPolygons;
-
-		// add original polygon
-		listPolygons.push_back(polyToRaster);
-		int nNewPolys = 1;
-
-		for (int p = 0; p < 4; p++) {
-			int nPolysToAdd = 0;
-			while (nNewPolys > 0) {
-				// take poly from list
-				polygon test = listPolygons.front();
-				listPolygons.pop_front();
-				nNewPolys--;
-
-				// clip against one of four screen edges
-				switch (p)
-				{
-				case 0:	nPolysToAdd = polygon::clipAgainstPlane({ 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, test, clipped[0], clipped[1]); break;
-				case 1:	nPolysToAdd = polygon::clipAgainstPlane({ 0.0f, (float)windowHeight - 1, 0.0f }, { 0.0f, -1.0f, 0.0f }, test, clipped[0], clipped[1]); break;
-				case 2:	nPolysToAdd = polygon::clipAgainstPlane({ 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, test, clipped[0], clipped[1]); break;
-				case 3:	nPolysToAdd = polygon::clipAgainstPlane({ (float)windowWidth - 1, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }, test, clipped[0], clipped[1]); break;
+		// distant objects are drawn with simplified meshes
+		const meshLod* level = &asset.levels[0];
+		if (levelOfDetail && asset.levels.size() > 1) {
+			level = &asset.selectLevel(lodErrorLimit(asset, matWorld, vEye));
+		}
+
+		if (instanceCaches[i].update(matWorld, level)) {
+			changes |= CHANGED_WORLD;
+		}
+	}
+	// shapes drawn one by one are not kept, so they are always made again
+	if (changes == 0 && !(reuseFrames && (rasterOnCPU || batchedSubmission))) {
+		changes = CHANGED_SETTINGS;
+	}
+	stats.changes = changes;
+
+	// nothing changed, frame buffer or SFML batch still hold the frame
+	if (changes == 0) {
+		return;
+	}
+	geometryFrames++;
+
+	// lists of this frame live in arena of calling thread, which is worker 0,
+	// task outputs in arenas of workers running them
+	geometryArenas.resize(pool.size());
+	FrameArena& frameArena = geometryArenas[0];
+	arenaVector<visibleInstance> visibleInstances(frameArena);	// instances in view frustum
+	arenaVector<instanceRange> vertPieces(frameArena);		// their visible vertices cut into pieces
+	arenaVector<instanceRange> polyPieces(frameArena);		// their visible polygons cut into pieces
+	arenaVector<unsigned int> cacheBuilds(frameArena);		// instances whose cache is filled this frame
+	arenaVector<std::pair<unsigned int, unsigned int>> cacheRequests(frameArena);	// instance and visible index of caches to fill
+	arenaVector<leafReference> testedLeaves(frameArena);	// leaves in view frustum, tested against occluders
+	arenaVector<unsigned int> occluderLeaves(frameArena);	// leaves of one instance drawn in current pass
+	arenaVector<arenaVector<polygon>> chunkPolys(frameArena);	// outputs of geometry tasks
+	visibleInstances.reserve(objectScene.instances.size());
+
+	// instances and parts of their meshes inside view frustum, clusters outside are skipped
+	// before any vertex work, whole instance is rejected by root of its hierarchy.
+	// With occlusion culling only leaves which were not hidden in previous frame are taken now,
+	// they are drawn as occluders and the rest of leaves is tested against them later.
+	// SFML outlines do not cover what is behind them, so nothing is hidden in wireframe
+	bool occlusion = occlusionCulling && frustumCulling && occlusionPause == 0 && !(wireframe && !rasterOnCPU);
+	if (occlusionPause > 0) {
+		occlusionPause--;
+	}
+	size_t nVerts = 0;
+	for (size_t i = 0; i < objectScene.instances.size(); i++) {
+		instanceCache& cache = instanceCaches[i];
+		const meshAsset& asset = *objectScene.assets[objectScene.instances[i].asset];
+		const mat4x4& matWorld = cache.matWorld;
+		const meshLod* level = cache.level;
+		unsigned int index = (unsigned int)visibleInstances.size();
+
+		if (frustumCulling && !level->hierarchy.nodes.empty()) {
+			frustum view = frustum::fromMatrix(matWorld * matView * matProj);
+			if (occlusion) {
+				level->hierarchy.cullLeaves(view, visibleLeaves);
+				if (visibleLeaves.empty()) {
+					continue;
+				}
+
+				// leaves of a new level were never tested
+				if (cache.occlusionLevel != level) {
+					cache.occlusionLevel = level;
+					cache.visibleLeaves.assign(level->hierarchy.nodes.size(), 1);
+				}
+				occluderLeaves.clear();
+				for (unsigned int leaf : visibleLeaves) {
+					if (cache.visibleLeaves[leaf]) {
+						occluderLeaves.push_back(leaf);
+					}
+					testedLeaves.push_back({ (unsigned int)i, index, leaf });
+				}
+				level->hierarchy.leafRanges(occluderLeaves.data(), occluderLeaves.size(), visiblePolys, visibleVerts);
+			}
+			else {
+				level->hierarchy.cull(view, visiblePolys, visibleVerts);
+				if (visiblePolys.empty()) {
+					continue;
+				}
+			}
+		}
+		else {
+			visiblePolys.assign(1, { 0, (unsigned int)level->geometry.polyCount() });
+			visibleVerts.assign(1, { 0, (unsigned int)level->geometry.vertexCount() });
+		}
+
+		visibleInstance visible;
+		visible.asset = &asset;
+		visible.level = level;
+		visible.matWorld = matWorld;
+		visible.lightDir = objectLightDirection(matWorld);
+		visible.vertexBase = nVerts;
+		nVerts += level->geometry.vertexCount();
+
+		// instance did not move since previous frame, world space data is worth keeping,
+		// instances moving every frame never pay for it
+		if (worldCache && cache.unchangedFrames > 0) {
+			cache.lastUsed = geometryFrames;
+			if (cache.valid) {
+				visible.cache = &cache;
+				stats.cachedInstances++;
+			}
+			else {
+				cacheRequests.push_back({ (unsigned int)i, index });
+			}
+		}
+
+		visibleInstances.push_back(visible);
+		splitRanges(index, visibleVerts, geometryChunkSize, vertPieces);
+		splitRanges(index, visiblePolys, geometryChunkSize, polyPieces);
+	}
+	endStage(stats, STAGE_CULL, stageStart);
+
+	// instances which stopped moving get their world space data once, if it fits in budget
+	if (!cacheRequests.empty()) {
+		size_t cacheBytes = 0;
+		for (const instanceCache& cache : instanceCaches) {
+			cacheBytes += cache.memoryBytes();
+		}
+		for (const auto& request : cacheRequests) {
+			if (reserveInstanceCache(request.first, cacheBytes)) {
+				cacheBuilds.push_back(request.first);
+				visibleInstances[request.second].cache = &instanceCaches[request.first];
+				stats.cachedInstances++;
+			}
+		}
+	}
+	if (!cacheBuilds.empty()) {
+		buildInstanceCaches(cacheBuilds, pool);
+	}
+	vertsTransformed.resize(nVerts);
+	vertsLight.resize(nVerts);
+
+	// transform vertices and make polygons of pieces, every task appends its output to chunkPolys
+	mat4x4 matIdentity;
+	auto buildPieces = [&]() {
+		arenaVector<meshRange> vertTasks(frameArena);
+		arenaVector<meshRange> polyTasks(frameArena);
+		groupTasks(vertPieces, geometryChunkSize, vertTasks);
+		groupTasks(polyPieces, geometryChunkSize, polyTasks);
+
+		// transform every unique visible vertex once in batches, polygons index into results,
+		// cached instances are already in world space
+		pool.parallelFor(vertTasks.size(), [&](size_t task, int) {
+			PROFILE_ZONE("transform task");
+			for (unsigned int p = vertTasks[task].first; p < vertTasks[task].last; p++) {
+				const meshRange& range = vertPieces[p].range;
+				const visibleInstance& instance = visibleInstances[vertPieces[p].instance];
+				const mesh& geometry = instance.level->geometry;
+				size_t count = range.last - range.first;
+				if (instance.cache) {
+					transformVertices(instance.cache->world, range.first, count, matIdentity, matView, matProj,
+						(float)windowWidth, (float)windowHeight, guardBand, vertsTransformed, instance.vertexBase + range.first);
+				}
+				else if (geometry.isCompact()) {
+					transformVertices(geometry.packedVerts, range.first, count, instance.matWorld, matView, matProj,
+						(float)windowWidth, (float)windowHeight, guardBand, vertsTransformed, instance.vertexBase + range.first);
+					lightVertices(geometry.packedNormals, range.first, count, instance.lightDir, ambientLight,
+						vertsLight.data() + instance.vertexBase + range.first);
+				}
+				else {
+					transformVertices(geometry.verts, range.first, count, instance.matWorld, matView, matProj,
+						(float)windowWidth, (float)windowHeight, guardBand, vertsTransformed, instance.vertexBase + range.first);
+					lightVertices(geometry.normals, range.first, count, instance.lightDir, ambientLight,
+						vertsLight.data() + instance.vertexBase + range.first);
+				}
+			}
+		});
+		endStage(stats, STAGE_TRANSFORM, stageStart);
+
+		// every chunk of polygons writes into its own output, taken from arena of worker running it,
+		// clipping seldom makes more polygons than go in
+		size_t firstChunk = chunkPolys.size();
+		for (size_t c = 0; c < polyTasks.size(); c++) {
+			chunkPolys.emplace_back(frameArena);
+		}
+		pool.parallelFor(polyTasks.size(), [&](size_t task, int worker) {
+			PROFILE_ZONE("geometry task");
+			size_t taskPolys = 0;
+			for (unsigned int p = polyTasks[task].first; p < polyTasks[task].last; p++) {
+				taskPolys += polyPieces[p].range.last - polyPieces[p].range.first;
+			}
+			arenaVector<polygon>& out = chunkPolys[firstChunk + task];
+			out = arenaVector<polygon>(geometryArenas[worker]);
+			out.reserve(taskPolys + 16);
+			for (unsigned int p = polyTasks[task].first; p < polyTasks[task].last; p++) {
+				const instanceRange& piece = polyPieces[p];
+				processPolygons(visibleInstances[piece.instance], piece.range.first, piece.range.last, out);
+			}
+		});
+		endStage(stats, STAGE_GEOMETRY, stageStart);
+	};
+	buildPieces();
+
+	if (occlusion && !testedLeaves.empty()) {
+		// polygons drawn so far become occluders, bands of block rows are drawn in parallel
+		occlusionBuffer.resize(windowWidth, windowHeight);
+		occlusionBuffer.clear();
+		int bandRows = std::max(1, (occlusionBuffer.blocksY + pool.size() * 4 - 1) / (pool.size() * 4));
+		int nBands = (occlusionBuffer.blocksY + bandRows - 1) / bandRows;
+		pool.parallelFor((size_t)nBands, [&](size_t band, int) {
+			PROFILE_ZONE("occluder task");
+			int firstRow = (int)band * bandRows;
+			for (const arenaVector<polygon>& chunk : chunkPolys) {
+				for (const polygon& poly : chunk) {
+					occlusionBuffer.drawOccluder(poly, firstRow, firstRow + bandRows, occluderMinArea);
 				}
+			}
+		});
+		occlusionBuffer.buildLevels();
+
+		// every leaf is tested, result decides whether it is an occluder in next frame,
+		// leaves which were not drawn yet and are not hidden are drawn now
+		vertPieces.clear();
+		polyPieces.clear();
+		size_t testedPolys = 0, hiddenPolys = 0;
+		size_t first = 0;
+		while (first < testedLeaves.size()) {
+			// leaves of one instance are next to each other
+			const leafReference& reference = testedLeaves[first];
+			size_t last = first + 1;
+			while (last < testedLeaves.size() && testedLeaves[last].visible == reference.visible) {
+				last++;
+			}
 
-				// add newly created polygons
-				for (int w = 0; w < nPolysToAdd; w++) {
-					listPolygons.push_back(clipped[w]);
+			const visibleInstance& visible = visibleInstances[reference.visible];
+			instanceCache& cache = instanceCaches[reference.instance];
+			mat4x4 matObjectToClip = visible.matWorld * matView * matProj;
+			occluderLeaves.clear();
+			for (size_t l = first; l < last; l++) {
+				unsigned int leaf = testedLeaves[l].leaf;
+				const bvhNode& node = visible.level->hierarchy.nodes[leaf];
+				bool hidden = occlusionBuffer.isBoxOccluded(node.boundsMin, node.boundsMax, matObjectToClip);
+				testedPolys += node.polys.last - node.polys.first;
+				hiddenPolys += hidden ? node.polys.last - node.polys.first : 0;
+				if (!cache.visibleLeaves[leaf]) {
+					if (hidden) {
+						stats.occludedLeaves++;
+					}
+					else {
+						occluderLeaves.push_back(leaf);
+					}
 				}
+				cache.visibleLeaves[leaf] = hidden ? 0 : 1;
 			}
-			nNewPolys = (int)listPolygons.size();
+			if (!occluderLeaves.empty()) {
+				visible.level->hierarchy.leafRanges(occluderLeaves.data(), occluderLeaves.size(), visiblePolys, visibleVerts);
+				splitRanges(reference.visible, visibleVerts, geometryChunkSize, vertPieces);
+				splitRanges(reference.visible, visiblePolys, geometryChunkSize, polyPieces);
+			}
+			first = last;
+		}
+		if (hiddenPolys < occlusionMinHidden * testedPolys) {
+			occlusionPause = occlusionPauseFrames;
+		}
+		endStage(stats, STAGE_OCCLUSION, stageStart);
+
+		if (!polyPieces.empty()) {
+			buildPieces();
+		}
+	}
+
+	// merge in chunk order, so result is the same as with one thread
+	size_t nPolyChunks = chunkPolys.size();
+	size_t nTotal = 0;
+	for (size_t c = 0; c < nPolyChunks; c++) {
+		nTotal += chunkPolys[c].size();
+	}
+	std::vector<polygon>& polys = slot.polys;
+	polys.clear();
+	polys.reserve(nTotal);
+	for (size_t c = 0; c < nPolyChunks; c++) {
+		polys.insert(polys.end(), chunkPolys[c].begin(), chunkPolys[c].end());
+	}
+	endStage(stats, STAGE_MERGE, stageStart);
+
+	// sort back to front, z-buffer makes it unnecessary for software raster
+	if (depthSort || !rasterOnCPU) {
+		polySorter.sort(polys, pool);
+	}
+	endStage(stats, STAGE_SORT, stageStart);
+
+	// lists above must not be used after this
+	chunkPolys.clear();
+	stats.arenaBytes = geometryArenas.reset();
+	for (const instanceCache& cache : instanceCaches) {
+		stats.worldCacheBytes += cache.memoryBytes();
+	}
+}
+
+void RenderEngine::drawFrame(frameSlot& slot) {
+	PROFILE_ZONE("draw frame");
+
+	// counted again every frame
+	drawCalls = 0;
+	lastFrame = slot.stats;
+	uint64_t stageStart = Profiler::now();
+
+	// there is nothing to draw SFML shapes into without a window
+	bool rasterOnCPU = softwareRaster || headless;
+
+	// nothing changed, frame buffer or SFML batch still hold the frame
+	bool reused = slot.stats.changes == 0;
+	if (rasterOnCPU) {
+		if (!reused) {
+			rasterizePolygons(slot.polys);
+			endStage(lastFrame, STAGE_RASTER, stageStart);
 		}
+		return;
+	}
+
+	submitPolygons(slot.polys, reused);
+	endStage(lastFrame, STAGE_SUBMIT, stageStart);
+}
+
+void RenderEngine::startPipeline() {
+	// restarting drops frames of running pipeline, same as stopPipeline()
+	stopPipeline();
+
+	// threads are split, so both stages together use threadCount of them
+	int total = threadCount > 0 ? threadCount : std::max(1, (int)std::thread::hardware_concurrency());
+	int geometry = pipelineGeometryThreads > 0 ? std::min(pipelineGeometryThreads, total) : std::max(1, total / 4);
+	geometryPool.resize(geometry);
+	threadPool.resize(std::max(1, total - geometry));
+
+	freeSlots.reset();
+	pendingSlots.reset();
+	readySlots.reset();
+	freeSlots.push(0);
+	freeSlots.push(1);
+	geometryThread = std::thread(&RenderEngine::geometryLoop, this);
+}
+
+void RenderEngine::stopPipeline() {
+	if (!geometryThread.joinable()) {
+		return;
+	}
+
+	// geometry thread finishes slots already pending, they are never drawn
+	pendingSlots.close();
+	geometryThread.join();
+}
+
+void RenderEngine::queueFrame() {
+	int slot;
+	freeSlots.pop(slot);
+	frameSlots[slot].params = captureFrame();
+	pendingSlots.push(slot);
+}
+
+void RenderEngine::drawQueuedFrame() {
+	int slot;
+	if (!readySlots.pop(slot)) {
+		return;
+	}
+	drawFrame(frameSlots[slot]);
+	freeSlots.push(slot);
+}
+
+void RenderEngine::geometryLoop() {
+	PROFILE_THREAD("geometry");
+	int slot;
+	while (pendingSlots.pop(slot)) {
+		prepareFrame(frameSlots[slot], geometryPool);
+		readySlots.push(slot);
+	}
+}
+
+void RenderEngine::invalidateFrame() {
+	pendingChanges = CHANGED_ALL;
+	instanceCaches.clear();
+}
+
+void RenderEngine::buildInstanceCaches(const arenaVector<unsigned int>& instances, ThreadPool& pool) {
+	PROFILE_ZONE("cache build");
+
+	// whole level is cached, also vertices outside of view this frame
+	arenaVector<instanceRange> cachePieces(geometryArenas[0]);
+	for (unsigned int i : instances) {
+		instanceCache& cache = instanceCaches[i];
+		const mesh& geometry = cache.level->geometry;
+		// data of other level is freed first, so arrays take exactly what was reserved
+		if (cache.world.size() != geometry.vertexCount()) {
+			cache.release();
+		}
+		cache.world.resize(geometry.vertexCount());
+		cache.light.resize(geometry.vertexCount());
+		splitRanges(i, { { 0, (unsigned int)geometry.vertexCount() } }, geometryChunkSize, cachePieces);
+	}
+	pool.parallelFor(cachePieces.size(), [&](size_t task, int) {
+		// same math as uncached path, so both give the same image
+		const instanceRange& piece = cachePieces[task];
+		instanceCache& cache = instanceCaches[piece.instance];
+		size_t first = piece.range.first, count = piece.range.last - piece.range.first;
+		const mesh& geometry = cache.level->geometry;
+		if (geometry.isCompact()) {
+			transformPositions(geometry.packedVerts, first, count, cache.matWorld, cache.world, first);
+			lightVertices(geometry.packedNormals, first, count, objectLightDirection(cache.matWorld), ambientLight,
+				cache.light.data() + first);
+		}
+		else {
+			transformPositions(geometry.verts, first, count, cache.matWorld, cache.world, first);
+			lightVertices(geometry.normals, first, count, objectLightDirection(cache.matWorld), ambientLight,
+				cache.light.data() + first);
+		}
+	});
+
+	for (unsigned int i : instances) {
+		instanceCaches[i].valid = true;
+	}
+}
+
+bool RenderEngine::reserveInstanceCache(size_t instance, size_t& cacheBytes) {
+	instanceCache& cache = instanceCaches[instance];
+	size_t held = cache.memoryBytes();
+	size_t needed = cache.level->geometry.vertexCount() * 4 * sizeof(float);
+	while (cacheBytes - held + needed > worldCacheBudget) {
+		instanceCache* oldest = nullptr;
+		for (instanceCache& other : instanceCaches) {
+			if (other.lastUsed < geometryFrames && other.memoryBytes() > 0 &&
+				(oldest == nullptr || other.lastUsed < oldest->lastUsed)) {
+				oldest = &other;
+			}
+		}
+		if (oldest == nullptr) {
+			cacheBytes -= held;
+			cache.release();
+			return false;
+		}
+		cacheBytes -= oldest->memoryBytes();
+		oldest->release();
+	}
+	cacheBytes += needed - held;
+	return true;
+}
+
+void RenderEngine::submitPolygons(std::vector<polygon>& polys, bool reuseBatch) {
+	if (reuseBatch) {
+		window.draw(polyBatch);
+		drawCalls++;
+		return;
+	}
 
+	// batch is refilled every frame, its storage is kept
+	if (batchedSubmission) {
+		polyBatch.clear();
+		polyBatch.setPrimitiveType(wireframe ? sf::Lines : sf::Triangles);
+	}
 
-		// final draw of polygon
-		for (auto& t : listPolygons) {
+	// polygons are already clipped to the guard band, SFML takes care of the rest
+	for (auto& t : polys) {
+		if (batchedSubmission) {
+			appendTriangle(t);
+		}
+		else if (wireframe) {
+			drawBlankTriange(t);
+		}
+		else {
 			drawColorTriange(t);
-			// drawBlankTriange(t);
 		}
 	}
+
+	if (batchedSubmission) {
+		window.draw(polyBatch);
+		drawCalls++;
+	}
+}
+
+float RenderEngine::lodErrorLimit(const meshAsset& asset, const mat4x4& matWorld, const vec4& camera) const {
+	const bvhNode& root = asset.levels[0].hierarchy.nodes[0];
+	vec4 center = {
+		(root.boundsMin[0] + root.boundsMax[0]) * 0.5f,
+		(root.boundsMin[1] + root.boundsMax[1]) * 0.5f,
+		(root.boundsMin[2] + root.boundsMax[2]) * 0.5f
+	};
+	float dx = root.boundsMax[0] - root.boundsMin[0];
+	float dy = root.boundsMax[1] - root.boundsMin[1];
+	float dz = root.boundsMax[2] - root.boundsMin[2];
+	float radius = 0.5f * sqrtf(dx * dx + dy * dy + dz * dz);
+
+	// largest scale of object -> world transform, errors and radius grow with it
+	float scale = 0.0f;
+	for (int r = 0; r < 3; r++) {
+		scale = std::max(scale, sqrtf(matWorld.m[r][0] * matWorld.m[r][0] + matWorld.m[r][1] * matWorld.m[r][1] + matWorld.m[r][2] * matWorld.m[r][2]));
+	}
+
+	// nearest point of bounding sphere, camera inside of it needs full detail
+	vec4 worldCenter = matWorld * center;
+	float cx = worldCenter.x - camera.x, cy = worldCenter.y - camera.y, cz = worldCenter.z - camera.z;
+	float distance = sqrtf(cx * cx + cy * cy + cz * cz) - radius * scale;
+	if (distance <= 0.1f || scale <= 0.0f) {
+		return 0.0f;
+	}
+
+	// pixels covered by one world unit at that distance, projection scales y by m[1][1]
+	float pixelsPerUnit = matProj.m[1][1] * 0.5f * windowHeight / distance;
+	return lodErrorPixels / (pixelsPerUnit * scale);
+}
+
+void RenderEngine::processPolygons(const visibleInstance& instance, size_t first, size_t last, arenaVector<polygon>& out) {
+	const vertexStream& vertsView = vertsTransformed.view;
+	const vertexStream& vertsScreen = vertsTransformed.screen;
+	const unsigned char* clipFlags = vertsTransformed.clipFlags.data();
+	const instanceCache* cache = instance.cache;
+
+	// light of instance vertices, indexed by mesh indices
+	const float* vertexLight = cache ? cache->light.data() : vertsLight.data() + instance.vertexBase;
+
+	// the same guard band the vertices were flagged against
+	float clipBand = effectiveGuardBand(guardBand, (float)windowWidth, (float)windowHeight);
+
+	// assemble polygons, vertices of instance start at its base in transformed streams
+	const mesh& geometry = instance.level->geometry;
+	for (size_t i = first; i < last; i++) {
+		polygon polyProjected;
+		unsigned int local[3];
+		geometry.polyIndices(i, local);
+		size_t idx[3] = {
+			instance.vertexBase + local[0],
+			instance.vertexBase + local[1],
+			instance.vertexBase + local[2]
+		};
+
+		// all vertices are on the outer side of one frustum plane
+		unsigned int flags0 = clipFlags[idx[0]], flags1 = clipFlags[idx[1]], flags2 = clipFlags[idx[2]];
+		if (flags0 & flags1 & flags2 & CLIP_OUTSIDE_VIEW) {
+			continue;
+		}
+
+		// if correct polygon side is visible, projected polygon is clockwise on screen,
+		// vertices behind near plane have no screen position, so side of camera is checked in view space
+		if (backfaceCulling) {
+			float facing;
+			if ((flags0 | flags1 | flags2) & CLIP_NEAR) {
+				vec4 p0 = vertsView.get(idx[0]);
+				vec4 line1 = vertsView.get(idx[1]) - p0;
+				vec4 line2 = vertsView.get(idx[2]) - p0;
+				facing = line1.cross(line2).dot(p0);
+			}
+			else {
+				vec4 s0 = vertsScreen.get(idx[0]), s1 = vertsScreen.get(idx[1]), s2 = vertsScreen.get(idx[2]);
+				facing = (s1.x - s0.x) * (s2.y - s0.y) - (s1.y - s0.y) * (s2.x - s0.x);
+			}
+			if (facing >= 0.0f) {
+				continue;
+			}
+		}
+
+		// illuminate by average light of vertices
+		// color is shade of gray, so keep in from 0 to 255
+		float light = (vertexLight[local[0]] + vertexLight[local[1]] + vertexLight[local[2]]) * (1.0f / 3.0f);
+		light = std::min(std::max(light, 0.0f), 1.0f);
+		unsigned char colorInt = (unsigned char)(light * 255.0f);
+		polyProjected.color = (colorInt << 24) + (colorInt << 16) + (colorInt << 8);
+
+		// polygon is in front of camera and inside guard band, batch has already projected it
+		unsigned int planeMask = (flags0 | flags1 | flags2) & CLIP_NEEDED;
+		if (planeMask == 0) {
+			polyProjected.p[0] = vertsScreen.get(idx[0]);
+			polyProjected.p[1] = vertsScreen.get(idx[1]);
+			polyProjected.p[2] = vertsScreen.get(idx[2]);
+			out.push_back(polyProjected);
+			continue;
+		}
+
+		// from view into clip space, clipping is done before perspective divide
+		vec4 polyClip[3];
+		for (int k = 0; k < 3; k++) {
+			polyClip[k] = matProj * vertsView.get(idx[k]);
+		}
+
+		// clip against crossed planes, result is convex polygon
+		vec4 clipped[maxClippedVerts];
+		int nClipped = clipTriangle(polyClip, planeMask, clipBand, clipped);
+		if (nClipped < 3) {
+			continue;
+		}
+
+		// project results of clipping and split them into triangle fan
+		vec4 screen[maxClippedVerts];
+		for (int k = 0; k < nClipped; k++) {
+			screen[k] = clipToScreen(clipped[k], (float)windowWidth, (float)windowHeight);
+		}
+		for (int k = 1; k + 1 < nClipped; k++) {
+			polyProjected.p[0] = screen[0];
+			polyProjected.p[1] = screen[k];
+			polyProjected.p[2] = screen[k + 1];
+			out.push_back(polyProjected);
+		}
+	}
+}
+
+void RenderEngine::rasterizePolygons(const std::vector<polygon>& polys) {
+	int nTiles = frameBuffer.tilesX() * frameBuffer.tilesY();
+	int tilesX = frameBuffer.tilesX();
+
+	// every worker bins its own contiguous part of polygons into arrays of its arena:
+	// tiles of every polygon are counted first, so each bin gets exact space
+	size_t nBinChunks = (size_t)threadPool.size();
+	rasterArenas.resize(nBinChunks);
+	arenaVector<tileBinning> bins(nBinChunks, tileBinning(), rasterArenas[0]);
+	threadPool.parallelFor(nBinChunks, [&](size_t chunk, int worker) {
+		PROFILE_ZONE("bin task");
+		FrameArena& arena = rasterArenas[worker];
+		size_t first = polys.size() * chunk / nBinChunks;
+		size_t last = polys.size() * (chunk + 1) / nBinChunks;
+
+		// tile rectangle of every polygon, empty one if it is outside
+		int* rects = arena.allocate<int>((last - first) * 4);
+		unsigned int* start = arena.allocate<unsigned int>(nTiles + 1);
+		std::fill(start, start + nTiles + 1, 0u);
+		for (size_t i = first; i < last; i++) {
+			int* rect = &rects[(i - first) * 4];
+			int minX, minY, maxX, maxY;
+			if (!frameBuffer.polygonBounds(polys[i], minX, minY, maxX, maxY)) {
+				rect[0] = 0; rect[1] = 0; rect[2] = -1; rect[3] = -1;
+				continue;
+			}
+			rect[0] = minX / FrameBuffer::tileSize;
+			rect[1] = minY / FrameBuffer::tileSize;
+			rect[2] = maxX / FrameBuffer::tileSize;
+			rect[3] = maxY / FrameBuffer::tileSize;
+			for (int ty = rect[1]; ty <= rect[3]; ty++) {
+				for (int tx = rect[0]; tx <= rect[2]; tx++) {
+					start[ty * tilesX + tx + 1]++;
+				}
+			}
+		}
+		for (int t = 0; t < nTiles; t++) {
+			start[t + 1] += start[t];
+		}
+
+		// polygons keep their order inside a bin
+		unsigned int* indices = arena.allocate<unsigned int>(start[nTiles]);
+		unsigned int* fill = arena.allocate<unsigned int>(nTiles);
+		std::copy(start, start + nTiles, fill);
+		for (size_t i = first; i < last; i++) {
+			const int* rect = &rects[(i - first) * 4];
+			for (int ty = rect[1]; ty <= rect[3]; ty++) {
+				for (int tx = rect[0]; tx <= rect[2]; tx++) {
+					indices[fill[ty * tilesX + tx]++] = (unsigned int)i;
+				}
+			}
+		}
+		bins[chunk].start = start;
+		bins[chunk].indices = indices;
+	});
+
+	// tiles do not share pixels, so they are cleared and drawn without locking,
+	// polygons keep their order inside a tile
+	threadPool.parallelFor(nTiles, [&](size_t tile, int) {
+		PROFILE_ZONE("tile");
+		int minX, minY, maxX, maxY;
+		frameBuffer.tileRect((int)tile, minX, minY, maxX, maxY);
+		frameBuffer.clearTile((int)tile);
+		for (size_t chunk = 0; chunk < nBinChunks; chunk++) {
+			const tileBinning& bin = bins[chunk];
+			for (unsigned int k = bin.start[tile]; k < bin.start[tile + 1]; k++) {
+				frameBuffer.drawTriangle(polys[bin.indices[k]], minX, minY, maxX, maxY);
+			}
+		}
+	});
+
+	bins.clear();
+	lastFrame.arenaBytes += rasterArenas.reset();
 }
 
 void RenderEngine::drawBlankTriange(polygon& poly) {
@@ -260,14 +1067,17 @@ void RenderEngine::drawBlankTriange(polygon& poly) {
 	line[0] = sf::Vertex(sf::Vector2f(poly.p[0].x, poly.p[0].y));
 	line[1] = sf::Vertex(sf::Vector2f(poly.p[1].x, poly.p[1].y));
 	window.draw(line, 2, sf::Lines);
+	drawCalls++;
 
 	line[0] = sf::Vertex(sf::Vector2f(poly.p[1].x, poly.p[1].y));
 	line[1] = sf::Vertex(sf::Vector2f(poly.p[2].x, poly.p[2].y));
 	window.draw(line, 2, sf::Lines);
+	drawCalls++;
 
 	line[0] = sf::Vertex(sf::Vector2f(poly.p[2].x, poly.p[2].y));
 	line[1] = sf::Vertex(sf::Vector2f(poly.p[0].x, poly.p[0].y));
 	window.draw(line, 2, sf::Lines);
+	drawCalls++;
 }
 
 void RenderEngine::drawColorTriange(polygon& poly) {
@@ -282,4 +1092,28 @@ void RenderEngine::drawColorTriange(polygon& poly) {
 	shape.setFillColor(sf::Color(poly.color | 0x000000FF));
 
 	window.draw(shape);
+	drawCalls++;
+}
+
+void RenderEngine::appendTriangle(polygon& poly) {
+	sf::Color color(poly.color | 0x000000FF);
+	sf::Vector2f p0(poly.p[0].x, poly.p[0].y);
+	sf::Vector2f p1(poly.p[1].x, poly.p[1].y);
+	sf::Vector2f p2(poly.p[2].x, poly.p[2].y);
+
+	if (wireframe) {
+		// outlines stay white, as drawBlankTriange draws them
+		color = sf::Color::White;
+		polyBatch.append(sf::Vertex(p0, color));
+		polyBatch.append(sf::Vertex(p1, color));
+		polyBatch.append(sf::Vertex(p1, color));
+		polyBatch.append(sf::Vertex(p2, color));
+		polyBatch.append(sf::Vertex(p2, color));
+		polyBatch.append(sf::Vertex(p0, color));
+	}
+	else {
+		polyBatch.append(sf::Vertex(p0, color));
+		polyBatch.append(sf::Vertex(p1, color));
+		polyBatch.append(sf::Vertex(p2, color));
+	}
 }
\ No newline at end of file
@@ -7,44 +7,206 @@
 #pragma once
 
 #include "Util.h"
+#include "FrameBuffer.h"
+#include "ThreadPool.h"
+#include "Scene.h"
+#include "DepthSort.h"
+#include "FrameStats.h"
+#include "Profiler.h"
+#include "SlotQueue.h"
+#include "FrameArena.h"
+#include "OcclusionBuffer.h"
+#include "FramePacer.h"
 
 #include "SFML/Graphics.hpp"
 
+// values previous frame was rendered with, compared to find what changed
+class frameInputs
+{
+public:
+	mat4x4 matView;
+	mat4x4 matProj;
+	vec4 vCamera;
+	int width = 0;
+	int height = 0;
+	unsigned int settings = 0;	// option switches packed into bits
+	float guardBand = 0.0f;
+};
+
+// camera and object rotation one frame is rendered with,
+// taken on main thread so geometry thread never reads changing values
+class frameParams
+{
+public:
+	vec4 vCamera;
+	float fYaw = 0;
+	float fTheta = 0;
+};
+
+// output of geometry stage for one frame, double buffered in pipelined mode
+class frameSlot
+{
+public:
+	frameParams params;
+	std::vector<polygon> polys;		// clipped and projected polygons, sorted if needed
+	frameStats stats;				// geometry stages, changes 0 - previous frame is shown again
+};
+
 class RenderEngine
 {
 public:
-	// because of OpenGL render inside window 
-	// width and height does not have much effect on performance
+	// size of window and of software frame buffer,
+	// with CPU raster pixel count directly affects performance
 	int windowWidth = 1920;
 	int windowHeight = 1080;
 	
 
 	sf::RenderWindow window;		// widnow handle
-	mesh objectMesh;				// object to be rendered
+	FrameBuffer frameBuffer;		// CPU color and depth targets
+	sf::Texture frameTexture;		// frame buffer copy on GPU
+	sf::Sprite frameSprite;			// used to blit frame buffer into window
+	bool headless = false;			// render into frame buffer only, no window
+	int headlessFrames = 1;			// number of frames rendered by run() in headless mode
+	bool softwareRaster = true;		// rasterize on CPU, otherwise draw polygons with SFML
+	bool batchedSubmission = true;	// SFML drawing: one vertex array per frame instead of draw per polygon
+	bool wireframe = false;			// SFML drawing: polygon outlines instead of solid polygons
+	sf::VertexArray polyBatch;		// polygons of current frame for batched submission
+	int drawCalls = 0;				// SFML draw calls made during last frame
+	frameStats lastFrame;			// time spent in render stages during last frame
+	std::string traceFile = "trace.json";	// profiler trace, written on F12
+	bool traceOnExit = false;		// also write profiler trace when run() ends
+	bool depthSort = false;			// sort polygons back to front, not needed with z-buffer
+	depthSorter polySorter;			// keeps keys and order of previous frame
+	float guardBand = 4.0f;			// polygons within this many screen sizes are not clipped, lowered on large screens to fit rasterizer
+	bool backfaceCulling = true;	// skip polygons facing away from camera
+	bool frustumCulling = true;		// skip mesh clusters outside of view
+	bool occlusionCulling = true;	// skip mesh clusters hidden behind others, needs frustumCulling, off in SFML wireframe
+	float occluderMinArea = 32.0f;	// polygons smaller than this many pixels are not drawn as occluders
+	float occlusionMinHidden = 0.1f;	// occlusion culling pauses if it hides less of polygons in view than this
+	int occlusionPauseFrames = 16;	// frames it pauses for, it costs more than it saves in open scenes
+	int occlusionPause = 0;			// frames of pause left
+	OcclusionBuffer occlusionBuffer;	// depth pyramid of occluders drawn in current frame
+	bool levelOfDetail = true;		// draw distant objects with simplified meshes
+	float lodErrorPixels = 1.0f;	// largest allowed error of simplified mesh on screen
+	bool reuseFrames = true;		// show previous frame again if nothing has changed
+	bool worldCache = true;			// keep world positions, normals and shading of instances which do not move
+	size_t worldCacheBudget = 256 << 20;	// bytes of world cache, least recently drawn instances are dropped above it
+	size_t geometryFrames = 0;		// frames whose geometry was made, clock of instanceCache::lastUsed
+	scene objectScene;				// objects to be rendered, load() puts one there
+	std::vector<instanceCache> instanceCaches;	// per scene instance, world space data and its last transform
+	frameInputs lastInputs;			// camera, projection and options of previous frame
+	unsigned int pendingChanges = CHANGED_ALL;	// forced by invalidateFrame()
+	std::vector<meshRange> visiblePolys;	// polygons of one instance in view frustum
+	std::vector<meshRange> visibleVerts;	// vertices used by visiblePolys
+	std::vector<unsigned int> visibleLeaves;	// hierarchy leaves of one instance in view frustum
+	transformedStream vertsTransformed;	// mesh vertices in world, camera and screen space, reused between frames
+	std::vector<float> vertsLight;	// diffuse light of vertices in vertsTransformed
+	frameSlot frameSlots[2];		// geometry output, second one is used only in pipelined mode
+	arenaSet geometryArenas;		// per worker of geometry stage, lists and outputs of tasks, reset after every frame
+	arenaSet rasterArenas;			// per worker of raster, tile bins, reset after every frame
+	ThreadPool threadPool{ 1 };		// workers of geometry and raster, only raster when pipelined
+	int threadCount = 0;			// threads used by geometry and raster, 0 - one per hardware thread
+	bool pipelined = false;			// run(): geometry of next frame runs while current one is drawn, one frame of latency
+	int pipelineGeometryThreads = 0;	// part of threadCount given to geometry when pipelined, 0 - a quarter, raster is usually heavier
+	ThreadPool geometryPool{ 1 };	// workers of geometry stage when pipelined
+	std::thread geometryThread;		// runs geometry stage when pipelined
+	SlotQueue freeSlots;			// frame slots not in use
+	SlotQueue pendingSlots;			// slots with parameters, waiting for geometry
+	SlotQueue readySlots;			// slots with polygons, waiting to be drawn
+	size_t geometryChunkSize = 4096;	// vertices or polygons per geometry task
 	mat4x4 matProj;					// world -> camere view projection	
 	// vec4 vCamera = { -5, 1, 0 };	// camera location
 	vec4 vCamera = { -25, 1, 0 };
 	vec4 vLookDir;					// camera direction
 	float fYaw = -45;				// camera rotation in horizontal plane
-	float fTheta = 0;				// object rotation
+	float fTheta = 0;				// rotation of every object around its vertical axis
 	float frameTime = 0;			// time between frames
 	
-	int maxFrameRate = 60;			// limit framerate
+	int maxFrameRate = 60;			// limit framerate, 0 - no limit
+	float spinMs = 2.0f;			// last part of frame limiter wait spent spinning instead of sleeping
+	bool verticalSync = false;		// wait for display refresh on present, frame limiter is then off
+	FramePacer framePacer;			// frame limiter of run(), frame time and latency percentiles
+	bool useMeshCache = true;		// load objects through binary cache files
 
-	// create window with default size
-	RenderEngine();
+	// create window with default size, or only frame buffer if headless
+	RenderEngine(const bool headless = false);
 
-	// start render of given file
+	// stops geometry thread if run() did not
+	~RenderEngine();
+
+	// make scene of given object file only, false on error
+	bool load(const std::string& filename);
+
+	// start render of given file, in headless mode renders headlessFrames frames
+	// and leaves last one in frameBuffer
 	void run(const std::string& filename, const bool toRotate = false);
 
 	// render window content
 	void render(float fElapsedTime);
 
+	// camera and rotation of next frame, also updates vLookDir
+	frameParams captureFrame();
+
+	// cull, transform, light, clip and sort polygons of slot.params frame into slot,
+	// tasks run on given pool
+	void prepareFrame(frameSlot& slot, ThreadPool& pool);
+
+	// rasterize or submit polygons of slot, fills lastFrame
+	void drawFrame(frameSlot& slot);
+
+	// start geometry thread and split threads between geometry and raster,
+	// running pipeline is stopped first
+	void startPipeline();
+
+	// wait for queued frames and stop geometry thread
+	void stopPipeline();
+
+	// hand current camera to geometry thread, returns at once if a slot is free
+	void queueFrame();
+
+	// wait for oldest queued frame and draw it
+	void drawQueuedFrame();
+
+	// geometry thread, prepares pending slots until pipeline is stopped
+	void geometryLoop();
+
+	// redo the whole next frame, needed after changes render can not see,
+	// e.g. of loaded meshes or of frame buffer
+	void invalidateFrame();
+
+	// fill world positions, normals and shading of given instances
+	void buildInstanceCaches(const arenaVector<unsigned int>& instances, ThreadPool& pool);
+
+	// make room for world cache of instance within worldCacheBudget, caches not drawn in current
+	// frame are dropped from least recently drawn one. cacheBytes is memory of all caches,
+	// updated. Returns false if it does not fit, cache of instance is then released
+	bool reserveInstanceCache(size_t instance, size_t& cacheBytes);
+
+	// add time of stage since stageStart to stats, stageStart is moved to now
+	void endStage(frameStats& stats, renderStage stage, uint64_t& stageStart);
+
+	// largest error in object units of level of detail for object drawn with matWorld
+	// and seen from camera, such that it stays within lodErrorPixels on screen
+	float lodErrorLimit(const meshAsset& asset, const mat4x4& matWorld, const vec4& camera) const;
+
+	// light, clip and project polygons [first, last) of instance mesh,
+	// vertices have to be transformed already
+	void processPolygons(const visibleInstance& instance, size_t first, size_t last, arenaVector<polygon>& out);
+
+	// draw polygons with SFML, or only draw polyBatch again if reuseBatch
+	void submitPolygons(std::vector<polygon>& polys, bool reuseBatch);
+
+	// bin polygons into screen tiles and rasterize tiles in parallel into frameBuffer
+	void rasterizePolygons(const std::vector<polygon>& polys);
+
 	// draw triangle with SFML as 3 thin lines
 	void drawBlankTriange(polygon& poly);
 
 	// draw solid triangle with SFML, colored as in poly.color RGBA format
 	void drawColorTriange(polygon& poly);
+
+	// add triangle (solid or white outline, depending on wireframe) to polyBatch
+	void appendTriangle(polygon& poly);
 };
 
 
@@ -0,0 +1,150 @@
+/* Short description: scene of mesh instances, every mesh file is
+ * loaded once and shared by all instances placed with own transforms,
+ * meshes get chain of simplified levels of detail
+ */
+
+#include "Scene.h"
+#include "Simplify.h"
+
+#include <cstring>
+
+void meshAsset::buildLevels(size_t minPolys, size_t maxLevels) {
+	// halve polygon count with every level
+	std::vector<size_t> targets;
+	size_t target = levels[0].geometry.polyCount() / 2;
+	while (levels.size() + targets.size() < maxLevels && target >= minPolys) {
+		targets.push_back(target);
+		target /= 2;
+	}
+
+	std::vector<mesh> meshes;
+	std::vector<float> errors;
+	simplifyMesh(levels[0].geometry, targets, meshes, errors);
+	for (size_t i = 0; i < meshes.size(); i++) {
+		meshLod level;
+		level.geometry = std::move(meshes[i]);
+		level.error = errors[i];
+		level.hierarchy.vertexCacheOrder = levels[0].hierarchy.vertexCacheOrder;
+		level.hierarchy.build(level.geometry);
+		levels.push_back(std::move(level));
+	}
+}
+
+const meshLod& meshAsset::selectLevel(float maxError) const {
+	size_t chosen = 0;
+	for (size_t i = 1; i < levels.size() && levels[i].error <= maxError; i++) {
+		chosen = i;
+	}
+	return levels[chosen];
+}
+
+bool instanceCache::update(const mat4x4& matWorld, const meshLod* level) {
+	if (this->level == level && memcmp(this->matWorld.m, matWorld.m, sizeof(matWorld.m)) == 0) {
+		unchangedFrames++;
+		return false;
+	}
+	this->matWorld = matWorld;
+	this->level = level;
+	unchangedFrames = 0;
+	valid = false;
+	return true;
+}
+
+size_t instanceCache::memoryBytes() const {
+	return (world.size() * 3 + light.size()) * sizeof(float);
+}
+
+void instanceCache::release() {
+	world = vertexStream();
+	light = std::vector<float>();
+	valid = false;
+}
+
+int scene::loadAsset(const std::string& filename, bool useMeshCache) {
+	for (size_t i = 0; i < assets.size(); i++) {
+		if (assets[i]->filename == filename) {
+			return (int)i;
+		}
+	}
+
+	std::unique_ptr<meshAsset> asset(new meshAsset());
+	asset->filename = filename;
+
+	// cache holds finished levels, nothing below has to be redone for them
+	meshCacheOptions options = cacheOptions();
+	uint64_t sourceSize = 0;
+	int64_t sourceMtime = 0;
+	if (useMeshCache && sourceFileInfo(filename, sourceSize, sourceMtime) &&
+		loadMeshCache(*asset, options, meshCachePath(filename), sourceSize, sourceMtime)) {
+		assets.push_back(std::move(asset));
+		return (int)assets.size() - 1;
+	}
+
+	asset->levels.resize(1);
+	meshLod& full = asset->levels[0];
+	if (!full.geometry.loadObjectFile(filename)) {
+		return -1;
+	}
+
+	// hierarchy for frustum culling, reorders polygons and vertices of mesh
+	full.hierarchy.leafSize = options.leafSize;
+	full.hierarchy.vertexCacheOrder = vertexCacheOrder;
+	full.hierarchy.build(full.geometry);
+	if (buildLods) {
+		asset->buildLevels(lodMinPolys, lodMaxLevels);
+	}
+
+	// levels are done with float data, from now on it is only rendered
+	if (compactMeshes) {
+		for (meshLod& level : asset->levels) {
+			level.geometry.compact();
+			if (level.geometry.isCompact()) {
+				// quantized positions move up to half a step
+				const float* step = level.geometry.packedVerts.scale;
+				float margin[3] = { step[0] * 0.5f, step[1] * 0.5f, step[2] * 0.5f };
+				level.hierarchy.inflate(margin);
+			}
+		}
+	}
+
+	// cache is only an optimization, read only asset folders are fine
+	if (useMeshCache && sourceSize != 0) {
+		saveMeshCache(*asset, options, meshCachePath(filename), sourceSize, sourceMtime);
+	}
+
+	assets.push_back(std::move(asset));
+	return (int)assets.size() - 1;
+}
+
+meshCacheOptions scene::cacheOptions() const {
+	meshCacheOptions options;
+	std::memset(&options, 0, sizeof(options));
+	options.leafSize = bvh().leafSize;
+	options.vertexCacheOrder = vertexCacheOrder ? 1 : 0;
+	options.buildLods = buildLods ? 1 : 0;
+	options.lodMinPolys = (uint32_t)lodMinPolys;
+	options.lodMaxLevels = (uint32_t)lodMaxLevels;
+	options.compactMeshes = compactMeshes ? 1 : 0;
+	return options;
+}
+
+size_t scene::addInstance(unsigned int asset, const mat4x4& matWorld) {
+	meshInstance instance;
+	instance.asset = asset;
+	instance.matWorld = matWorld;
+	instances.push_back(instance);
+	return instances.size() - 1;
+}
+
+void scene::clear() {
+	instances.clear();
+	assets.clear();
+}
+
+size_t scene::polyCount() const {
+	size_t count = 0;
+	for (const meshInstance& instance : instances) {
+		count += assets[instance.asset]->levels[0].geometry.polyCount();
+	}
+	return count;
+}
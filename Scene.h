@@ -0,0 +1,120 @@
+/* Short description: scene of mesh instances, every mesh file is
+ * loaded once and shared by all instances placed with own transforms,
+ * meshes get chain of simplified levels of detail
+ */
+
+#pragma once
+
+#include "Util.h"
+#include "Bvh.h"
+#include "MeshCache.h"
+
+#include <vector>
+#include <string>
+#include <memory>
+
+// one level of detail of mesh with its culling hierarchy
+class meshLod
+{
+public:
+	mesh geometry;
+	bvh hierarchy;			// root bounds are bounds of the whole mesh
+	float error = 0.0f;		// largest distance from original surface, object units
+};
+
+// loaded mesh with its levels of detail, shared between instances
+class meshAsset
+{
+public:
+	std::string filename;
+	std::vector<meshLod> levels;	// 0 - loaded mesh, every next has about half of polygons
+
+	// simplify level 0 into coarser levels until minPolys or maxLevels is reached
+	void buildLevels(size_t minPolys, size_t maxLevels);
+
+	// coarsest level with error not above maxError (in object units)
+	const meshLod& selectLevel(float maxError) const;
+};
+
+// one placed copy of asset
+class meshInstance
+{
+public:
+	unsigned int asset = 0;		// index in scene::assets
+	mat4x4 matWorld;			// object -> world transform, expected affine
+};
+
+// world space data of instance kept between frames while its transform and level
+// of detail stay the same, so only view dependent work is redone when camera moves
+class instanceCache
+{
+public:
+	mat4x4 matWorld;				// transform the instance had in previous frame
+	const meshLod* level = nullptr;	// level it had in previous frame
+	unsigned int unchangedFrames = 0;	// frames since transform or level changed
+	size_t lastUsed = 0;			// last frame the instance was drawn from cache, for eviction
+	bool valid = false;				// streams below match matWorld and level
+	vertexStream world;				// all level vertices in world space
+	std::vector<float> light;		// diffuse light of all level vertices
+	const meshLod* occlusionLevel = nullptr;	// level visibleLeaves belong to
+	std::vector<unsigned char> visibleLeaves;	// per node of level hierarchy, leaf was not hidden in previous frame
+
+	// remember transform and level of current frame, cached data is dropped
+	// if they differ from previous frame, returns true if they differ
+	bool update(const mat4x4& matWorld, const meshLod* level);
+
+	// bytes taken by world and light
+	size_t memoryBytes() const;
+
+	// drop world space data and free its memory
+	void release();
+};
+
+// instance which passed frustum culling in current frame
+class visibleInstance
+{
+public:
+	const meshAsset* asset = nullptr;
+	const meshLod* level = nullptr;	// level of detail chosen for this frame
+	const instanceCache* cache = nullptr;	// world space data if it is valid, otherwise nullptr
+	mat4x4 matWorld;			// object -> world, including per frame rotation
+	vec4 lightDir;				// direction towards light in object space
+	size_t vertexBase = 0;		// index of first instance vertex in transformed streams
+};
+
+// range of polygons or vertices of one visible instance
+class instanceRange
+{
+public:
+	unsigned int instance = 0;	// index in visible instances
+	meshRange range;
+};
+
+class scene
+{
+public:
+	std::vector<std::unique_ptr<meshAsset>> assets;
+	std::vector<meshInstance> instances;
+	bool buildLods = true;			// simplify loaded meshes into levels of detail
+	size_t lodMinPolys = 64;		// coarsest level has at least this many polygons
+	size_t lodMaxLevels = 8;		// including the loaded mesh
+	bool vertexCacheOrder = true;	// reorder polygons of loaded meshes for vertex reuse
+	bool compactMeshes = false;		// keep loaded meshes quantized, see mesh::compact
+
+	// load file as asset or find it if already loaded, returns asset index, -1 on error.
+	// With useMeshCache all levels are taken with their hierarchies from binary cache next
+	// to the file, cache is (re)written when it is missing or outdated
+	int loadAsset(const std::string& filename, bool useMeshCache = true);
+
+	// options loaded levels are built with, cache files have to match them
+	meshCacheOptions cacheOptions() const;
+
+	// place asset into the world, returns instance index
+	size_t addInstance(unsigned int asset, const mat4x4& matWorld);
+
+	// remove all instances and assets
+	void clear();
+
+	// polygons of all instances at full detail
+	size_t polyCount() const;
+};
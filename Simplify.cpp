@@ -0,0 +1,357 @@
+/* Short description: mesh simplification by edge collapses
+ * ordered by quadric error metrics (Garland, Heckbert)
+ */
+
+#include "Simplify.h"
+#include "Profiler.h"
+
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// double precision point, collapses accumulate rounding otherwise
+struct point
+{
+	double x, y, z;
+};
+
+static point sub(const point& a, const point& b) {
+	return { a.x - b.x, a.y - b.y, a.z - b.z };
+}
+
+static point cross(const point& a, const point& b) {
+	return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+static double dot(const point& a, const point& b) {
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+// sum of squared distances to set of planes, symmetric 4x4 matrix stored as upper triangle
+struct quadric
+{
+	double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+	double a11 = 0, a12 = 0, a13 = 0;
+	double a22 = 0, a23 = 0;
+	double a33 = 0;
+
+	// plane a * x + b * y + c * z + d = 0 with unit normal
+	void addPlane(double a, double b, double c, double d) {
+		a00 += a * a; a01 += a * b; a02 += a * c; a03 += a * d;
+		a11 += b * b; a12 += b * c; a13 += b * d;
+		a22 += c * c; a23 += c * d;
+		a33 += d * d;
+	}
+
+	void add(const quadric& q) {
+		a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+		a11 += q.a11; a12 += q.a12; a13 += q.a13;
+		a22 += q.a22; a23 += q.a23;
+		a33 += q.a33;
+	}
+
+	double evaluate(const point& p) const {
+		double cost = a00 * p.x * p.x + 2 * a01 * p.x * p.y + 2 * a02 * p.x * p.z + 2 * a03 * p.x
+			+ a11 * p.y * p.y + 2 * a12 * p.y * p.z + 2 * a13 * p.y
+			+ a22 * p.z * p.z + 2 * a23 * p.z
+			+ a33;
+		return std::max(0.0, cost);
+	}
+
+	// point of smallest error, false if matrix is (close to) singular
+	bool optimum(point& p) const {
+		double det = a00 * (a11 * a22 - a12 * a12) - a01 * (a01 * a22 - a12 * a02) + a02 * (a01 * a12 - a11 * a02);
+		if (std::fabs(det) < 1e-12) {
+			return false;
+		}
+		double bx = -a03, by = -a13, bz = -a23;
+		p.x = (bx * (a11 * a22 - a12 * a12) - a01 * (by * a22 - a12 * bz) + a02 * (by * a12 - a11 * bz)) / det;
+		p.y = (a00 * (by * a22 - a12 * bz) - bx * (a01 * a22 - a12 * a02) + a02 * (a01 * bz - by * a02)) / det;
+		p.z = (a00 * (a11 * bz - by * a12) - a01 * (a01 * bz - by * a02) + bx * (a01 * a12 - a11 * a02)) / det;
+		return true;
+	}
+};
+
+// candidate collapse of edge (keep, remove) into target, valid while both stamps match
+struct collapse
+{
+	double cost;
+	unsigned int keep, remove;
+	unsigned int keepStamp, removeStamp;
+	point target;
+
+	bool operator>(const collapse& c) const { return cost > c.cost; }
+};
+
+class simplifier
+{
+public:
+	std::vector<point> pos;
+	std::vector<quadric> quadrics;
+	std::vector<unsigned int> stamps;
+	std::vector<bool> vertAlive;
+	std::vector<unsigned int> tris;
+	std::vector<bool> triAlive;
+	std::vector<std::vector<unsigned int>> vertTris;
+	std::priority_queue<collapse, std::vector<collapse>, std::greater<collapse>> heap;
+	std::vector<unsigned int> neighbours;	// scratch buffer of apply
+	size_t liveTris = 0;
+
+	void init(const mesh& m);
+	void pushEdge(unsigned int a, unsigned int b);
+	bool flips(unsigned int moved, unsigned int other, const point& target) const;
+	void apply(const collapse& c);
+	void write(mesh& out) const;
+};
+
+void simplifier::init(const mesh& m) {
+	// vertices at the same position are welded, otherwise seams between
+	// separately modelled patches would be open borders and crack apart
+	size_t nIn = m.verts.size();
+	std::vector<unsigned int> order(nIn);
+	for (size_t i = 0; i < nIn; i++) {
+		order[i] = (unsigned int)i;
+	}
+	auto less = [&](unsigned int a, unsigned int b) {
+		if (m.verts.x[a] != m.verts.x[b]) return m.verts.x[a] < m.verts.x[b];
+		if (m.verts.y[a] != m.verts.y[b]) return m.verts.y[a] < m.verts.y[b];
+		return m.verts.z[a] < m.verts.z[b];
+	};
+	std::sort(order.begin(), order.end(), less);
+	std::vector<unsigned int> weld(nIn);
+	for (size_t i = 0; i < nIn; i++) {
+		if (i == 0 || less(order[i - 1], order[i])) {
+			pos.push_back({ m.verts.x[order[i]], m.verts.y[order[i]], m.verts.z[order[i]] });
+		}
+		weld[order[i]] = (unsigned int)pos.size() - 1;
+	}
+	size_t nVerts = pos.size();
+
+	// polygons which lost an edge by welding are dropped
+	tris.clear();
+	tris.reserve(m.indices.size());
+	for (size_t t = 0; t < m.polyCount(); t++) {
+		unsigned int a = weld[m.indices[t * 3]], b = weld[m.indices[t * 3 + 1]], c = weld[m.indices[t * 3 + 2]];
+		if (a == b || b == c || a == c) continue;
+		tris.push_back(a);
+		tris.push_back(b);
+		tris.push_back(c);
+	}
+	size_t nTris = tris.size() / 3;
+
+	quadrics.assign(nVerts, quadric());
+	stamps.assign(nVerts, 0);
+	vertAlive.assign(nVerts, true);
+	triAlive.assign(nTris, true);
+	liveTris = nTris;
+	vertTris.assign(nVerts, std::vector<unsigned int>());
+
+	// planes of polygons around every vertex, edges are collected as (min, max) pairs
+	std::vector<uint64_t> edges;
+	edges.reserve(tris.size());
+	for (size_t t = 0; t < nTris; t++) {
+		const unsigned int* v = &tris[t * 3];
+		point n = cross(sub(pos[v[1]], pos[v[0]]), sub(pos[v[2]], pos[v[0]]));
+		double len = std::sqrt(dot(n, n));
+		if (len > 0.0) {
+			n = { n.x / len, n.y / len, n.z / len };
+			double d = -dot(n, pos[v[0]]);
+			for (int k = 0; k < 3; k++) {
+				quadrics[v[k]].addPlane(n.x, n.y, n.z, d);
+			}
+		}
+		for (int k = 0; k < 3; k++) {
+			vertTris[v[k]].push_back((unsigned int)t);
+			unsigned int a = v[k], b = v[(k + 1) % 3];
+			edges.push_back(((uint64_t)std::min(a, b) << 32) | std::max(a, b));
+		}
+	}
+
+	// edge of one polygon only is on open border, plane through it perpendicular
+	// to the polygon keeps border vertices from moving inwards
+	std::sort(edges.begin(), edges.end());
+	for (size_t i = 0; i < edges.size(); ) {
+		size_t j = i;
+		while (j < edges.size() && edges[j] == edges[i]) j++;
+		unsigned int a = (unsigned int)(edges[i] >> 32), b = (unsigned int)edges[i];
+		if (j - i == 1) {
+			for (unsigned int t : vertTris[a]) {
+				const unsigned int* v = &tris[t * 3];
+				if (v[0] != b && v[1] != b && v[2] != b) continue;
+				point n = cross(sub(pos[v[1]], pos[v[0]]), sub(pos[v[2]], pos[v[0]]));
+				point e = sub(pos[b], pos[a]);
+				point p = cross(e, n);
+				double len = std::sqrt(dot(p, p));
+				if (len > 0.0) {
+					p = { p.x / len, p.y / len, p.z / len };
+					double d = -dot(p, pos[a]);
+					quadrics[a].addPlane(p.x, p.y, p.z, d);
+					quadrics[b].addPlane(p.x, p.y, p.z, d);
+				}
+				break;
+			}
+		}
+		pushEdge(a, b);
+		i = j;
+	}
+}
+
+void simplifier::pushEdge(unsigned int a, unsigned int b) {
+	quadric q = quadrics[a];
+	q.add(quadrics[b]);
+
+	// endpoints and middle are always candidates, optimum only when it stays near the edge
+	point mid = { (pos[a].x + pos[b].x) * 0.5, (pos[a].y + pos[b].y) * 0.5, (pos[a].z + pos[b].z) * 0.5 };
+	point candidates[4] = { pos[a], pos[b], mid, mid };
+	int nCandidates = 3;
+	point opt;
+	if (q.optimum(opt)) {
+		point e = sub(pos[b], pos[a]);
+		point off = sub(opt, mid);
+		if (dot(off, off) <= dot(e, e)) {
+			candidates[nCandidates++] = opt;
+		}
+	}
+
+	collapse c;
+	c.cost = -1.0;
+	for (int i = 0; i < nCandidates; i++) {
+		double cost = q.evaluate(candidates[i]);
+		if (c.cost < 0.0 || cost < c.cost) {
+			c.cost = cost;
+			c.target = candidates[i];
+		}
+	}
+	c.keep = a;
+	c.remove = b;
+	c.keepStamp = stamps[a];
+	c.removeStamp = stamps[b];
+	heap.push(c);
+}
+
+// polygons of moved vertex which do not contain other vertex must not turn over
+bool simplifier::flips(unsigned int moved, unsigned int other, const point& target) const {
+	for (unsigned int t : vertTris[moved]) {
+		if (!triAlive[t]) continue;
+		const unsigned int* v = &tris[t * 3];
+		if (v[0] == other || v[1] == other || v[2] == other) continue;
+
+		point p[3] = { pos[v[0]], pos[v[1]], pos[v[2]] };
+		point before = cross(sub(p[1], p[0]), sub(p[2], p[0]));
+		for (int k = 0; k < 3; k++) {
+			if (v[k] == moved) p[k] = target;
+		}
+		point after = cross(sub(p[1], p[0]), sub(p[2], p[0]));
+		if (dot(before, after) <= 0.0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void simplifier::apply(const collapse& c) {
+	unsigned int keep = c.keep, remove = c.remove;
+	pos[keep] = c.target;
+	quadrics[keep].add(quadrics[remove]);
+	vertAlive[remove] = false;
+	stamps[keep]++;
+	stamps[remove]++;
+
+	// polygons on the edge disappear, others of removed vertex move to kept one
+	for (unsigned int t : vertTris[remove]) {
+		if (!triAlive[t]) continue;
+		unsigned int* v = &tris[t * 3];
+		if (v[0] == keep || v[1] == keep || v[2] == keep) {
+			triAlive[t] = false;
+			liveTris--;
+			continue;
+		}
+		for (int k = 0; k < 3; k++) {
+			if (v[k] == remove) v[k] = keep;
+		}
+		vertTris[keep].push_back(t);
+	}
+	vertTris[remove].clear();
+
+	std::vector<unsigned int>& own = vertTris[keep];
+	own.erase(std::remove_if(own.begin(), own.end(), [&](unsigned int t) { return !triAlive[t]; }), own.end());
+
+	// costs of all edges around kept vertex changed
+	neighbours.clear();
+	for (unsigned int t : own) {
+		for (int k = 0; k < 3; k++) {
+			unsigned int n = tris[t * 3 + k];
+			if (n != keep) neighbours.push_back(n);
+		}
+	}
+	std::sort(neighbours.begin(), neighbours.end());
+	neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+	for (unsigned int n : neighbours) {
+		pushEdge(keep, n);
+	}
+}
+
+void simplifier::write(mesh& out) const {
+	out.verts.clear();
+	out.indices.clear();
+	out.indices.reserve(liveTris * 3);
+
+	// vertices are renumbered in order of first use
+	std::vector<unsigned int> remap(pos.size(), UINT32_MAX);
+	for (size_t t = 0; t < triAlive.size(); t++) {
+		if (!triAlive[t]) continue;
+		for (int k = 0; k < 3; k++) {
+			unsigned int v = tris[t * 3 + k];
+			if (remap[v] == UINT32_MAX) {
+				remap[v] = (unsigned int)out.verts.size();
+				out.verts.push_back(vec4((float)pos[v].x, (float)pos[v].y, (float)pos[v].z));
+			}
+			out.indices.push_back(remap[v]);
+		}
+	}
+
+	// welded and moved vertices have no normals of their own
+	out.computeNormals();
+}
+
+size_t simplifyMesh(const mesh& in, const std::vector<size_t>& targetPolys, std::vector<mesh>& out, std::vector<float>& errors) {
+	PROFILE_ZONE("simplify mesh");
+	out.clear();
+	errors.clear();
+	if (targetPolys.empty() || in.polyCount() <= targetPolys[0]) {
+		return 0;
+	}
+
+	simplifier s;
+	s.init(in);
+
+	double maxCost = 0.0;
+	size_t level = 0;
+	while (level < targetPolys.size() && !s.heap.empty()) {
+		collapse c = s.heap.top();
+		s.heap.pop();
+
+		// entry is outdated when any of its vertices has changed since
+		if (!s.vertAlive[c.keep] || !s.vertAlive[c.remove] ||
+			s.stamps[c.keep] != c.keepStamp || s.stamps[c.remove] != c.removeStamp) {
+			continue;
+		}
+		if (s.flips(c.keep, c.remove, c.target) || s.flips(c.remove, c.keep, c.target)) {
+			continue;
+		}
+
+		s.apply(c);
+		maxCost = std::max(maxCost, c.cost);
+
+		// quadrics keep planes of the original, so error of every level is measured against it
+		while (level < targetPolys.size() && s.liveTris <= targetPolys[level]) {
+			out.emplace_back();
+			s.write(out.back());
+			errors.push_back((float)std::sqrt(maxCost));
+			level++;
+		}
+	}
+	return out.size();
+}
@@ -0,0 +1,17 @@
+/* Short description: mesh simplification by edge collapses
+ * ordered by quadric error metrics (Garland, Heckbert)
+ */
+
+#pragma once
+
+#include "Util.h"
+
+#include <vector>
+
+// collapse edges of mesh in order of quadric error and take a copy every time
+// polygon count drops to the next of targetPolys (sorted from largest), so one pass
+// gives whole chain of levels. Error of level is the largest distance of collapsed
+// vertex to planes of original polygons around it, in object units. Open borders
+// are kept in place, normals of levels are computed from their polygons.
+// Returns number of levels written into out and errors
+size_t simplifyMesh(const mesh& in, const std::vector<size_t>& targetPolys, std::vector<mesh>& out, std::vector<float>& errors);
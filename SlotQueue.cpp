@@ -0,0 +1,38 @@
+/* Short description: bounded blocking queue of buffer slot indices,
+ * hands double buffered frame data between pipeline stages
+ */
+
+#include "SlotQueue.h"
+
+SlotQueue::SlotQueue(size_t capacity) : capacity(capacity) {
+}
+
+void SlotQueue::push(int slot) {
+	std::unique_lock<std::mutex> lk(lock);
+	changed.wait(lk, [this] { return closed || slots.size() < capacity; });
+	if (closed) return;
+	slots.push_back(slot);
+	changed.notify_all();
+}
+
+bool SlotQueue::pop(int& slot) {
+	std::unique_lock<std::mutex> lk(lock);
+	changed.wait(lk, [this] { return closed || !slots.empty(); });
+	if (slots.empty()) return false;
+	slot = slots.front();
+	slots.pop_front();
+	changed.notify_all();
+	return true;
+}
+
+void SlotQueue::close() {
+	std::lock_guard<std::mutex> lk(lock);
+	closed = true;
+	changed.notify_all();
+}
+
+void SlotQueue::reset() {
+	std::lock_guard<std::mutex> lk(lock);
+	slots.clear();
+	closed = false;
+}
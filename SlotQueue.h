@@ -0,0 +1,36 @@
+/* Short description: bounded blocking queue of buffer slot indices,
+ * hands double buffered frame data between pipeline stages
+ */
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+class SlotQueue
+{
+public:
+	// push blocks while queue holds capacity slots
+	explicit SlotQueue(size_t capacity = 2);
+
+	// add slot, waits for free space, does nothing on closed queue
+	void push(int slot);
+
+	// take oldest slot, waits until there is one,
+	// false if queue is closed and empty
+	bool pop(int& slot);
+
+	// wake all waiting threads, pop fails once queue is empty
+	void close();
+
+	// drop all slots and open queue again
+	void reset();
+
+private:
+	std::mutex lock;
+	std::condition_variable changed;
+	std::deque<int> slots;
+	size_t capacity;
+	bool closed = false;
+};
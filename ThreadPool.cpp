@@ -0,0 +1,152 @@
+/* Short description: persistent pool of worker threads with
+ * work stealing, runs indexed tasks in parallel
+ */
+
+#include "ThreadPool.h"
+#include "Profiler.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threadCount) {
+	resize(threadCount);
+}
+
+ThreadPool::~ThreadPool() {
+	stop();
+}
+
+void ThreadPool::resize(int threadCount) {
+	if (threadCount <= 0) {
+		threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	if (threadCount == size()) {
+		return;
+	}
+
+	stop();
+
+	queues.clear();
+	for (int i = 0; i < threadCount; i++) {
+		queues.emplace_back(new workerQueue());
+	}
+
+	stopping = false;
+	for (int i = 1; i < threadCount; i++) {
+		threads.emplace_back(&ThreadPool::workerLoop, this, i);
+	}
+}
+
+int ThreadPool::size() const {
+	return (int)queues.size();
+}
+
+void ThreadPool::stop() {
+	{
+		std::lock_guard<std::mutex> lk(jobMutex);
+		stopping = true;
+	}
+	jobStart.notify_all();
+	for (auto& t : threads) {
+		t.join();
+	}
+	threads.clear();
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t, int)>& task) {
+	if (count == 0) {
+		return;
+	}
+
+	// nothing to share, avoid waking anyone
+	if (threads.empty() || count == 1) {
+		for (size_t i = 0; i < count; i++) {
+			task(i, 0);
+		}
+		return;
+	}
+
+	// hand out contiguous blocks of indices
+	size_t nWorkers = queues.size();
+	for (size_t w = 0; w < nWorkers; w++) {
+		std::lock_guard<std::mutex> lk(queues[w]->lock);
+		for (size_t i = count * w / nWorkers; i < count * (w + 1) / nWorkers; i++) {
+			queues[w]->tasks.push_back(i);
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lk(jobMutex);
+		job = &task;
+		remaining = count;
+		jobGeneration++;
+	}
+	jobStart.notify_all();
+
+	runTasks(0, task);
+
+	// wait for tasks still running on other workers
+	std::unique_lock<std::mutex> lk(jobMutex);
+	jobDone.wait(lk, [this] { return remaining == 0 && activeWorkers == 0; });
+	job = nullptr;
+}
+
+void ThreadPool::workerLoop(int worker) {
+	PROFILE_THREAD("worker " + std::to_string(worker));
+	uint64_t seenGeneration = 0;
+	while (true) {
+		const std::function<void(size_t, int)>* task;
+		{
+			std::unique_lock<std::mutex> lk(jobMutex);
+			jobStart.wait(lk, [&] { return stopping || jobGeneration != seenGeneration; });
+			if (stopping) return;
+			seenGeneration = jobGeneration;
+			task = job;
+			if (task == nullptr) continue;
+			activeWorkers++;
+		}
+
+		runTasks(worker, *task);
+
+		{
+			std::lock_guard<std::mutex> lk(jobMutex);
+			activeWorkers--;
+			if (activeWorkers == 0 && remaining == 0) {
+				jobDone.notify_all();
+			}
+		}
+	}
+}
+
+void ThreadPool::runTasks(int worker, const std::function<void(size_t, int)>& task) {
+	size_t index;
+	while (popTask(worker, index)) {
+		task(index, worker);
+		remaining--;
+	}
+}
+
+bool ThreadPool::popTask(int worker, size_t& index) {
+	// own queue first, in order
+	{
+		workerQueue& own = *queues[worker];
+		std::lock_guard<std::mutex> lk(own.lock);
+		if (!own.tasks.empty()) {
+			index = own.tasks.front();
+			own.tasks.pop_front();
+			return true;
+		}
+	}
+
+	// steal last task of another worker
+	size_t nWorkers = queues.size();
+	for (size_t i = 1; i < nWorkers; i++) {
+		workerQueue& victim = *queues[(worker + i) % nWorkers];
+		std::lock_guard<std::mutex> lk(victim.lock);
+		if (!victim.tasks.empty()) {
+			index = victim.tasks.back();
+			victim.tasks.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,62 @@
+/* Short description: persistent pool of worker threads with
+ * work stealing, runs indexed tasks in parallel
+ */
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <cstdint>
+
+class ThreadPool
+{
+public:
+	// threadCount includes the calling thread, 0 - one per hardware thread
+	explicit ThreadPool(int threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// restart pool with another number of threads, does nothing if count is the same
+	void resize(int threadCount);
+
+	// number of threads running tasks, including the calling thread
+	int size() const;
+
+	// run task(index, worker) for every index in [0, count) and wait for all of them,
+	// worker is in [0, size()), 0 is the calling thread. Tasks are split between
+	// workers in contiguous blocks, idle workers steal from the back of busy ones
+	void parallelFor(size_t count, const std::function<void(size_t index, int worker)>& task);
+
+private:
+	// task indices owned by one worker, owner pops front, thieves pop back
+	struct workerQueue
+	{
+		std::mutex lock;
+		std::deque<size_t> tasks;
+	};
+
+	void workerLoop(int worker);
+	void runTasks(int worker, const std::function<void(size_t, int)>& task);
+	bool popTask(int worker, size_t& index);
+	void stop();
+
+	std::vector<std::thread> threads;
+	std::vector<std::unique_ptr<workerQueue>> queues;	// one per worker, 0 is the calling thread
+
+	std::mutex jobMutex;
+	std::condition_variable jobStart;
+	std::condition_variable jobDone;
+	const std::function<void(size_t, int)>* job = nullptr;
+	uint64_t jobGeneration = 0;
+	int activeWorkers = 0;
+	bool stopping = false;
+	std::atomic<size_t> remaining{ 0 };
+};
@@ -4,163 +4,184 @@
  */
 
 #include "Util.h"
+#include "MappedFile.h"
+#include "ObjLoader.h"
+#include "Profiler.h"
 
-#include <fstream>
-#include <iostream>
-#include <strstream>
-#include <cassert>
-
-int polygon::clipAgainstPlane(vec4 plane_p, vec4 plane_n, polygon& in_poly, polygon& out_poly1, polygon& out_poly2) {
-	// normilize plane
-	plane_n = plane_n.normalize();
-
-	// distance from plane to point
-	// If distance is negative point is "outside" the plane
-	auto dist = [&](vec4& p) {
-		vec4 n = p.normalize();
-		return (plane_n.x * p.x + plane_n.y * p.y + plane_n.z * p.z - plane_n.dot(plane_p));
-	};
-
-	// poins on both sizes of plane
-	vec4* inside_points[3];  int nInsidePointCount = 0;
-	vec4* outside_points[3]; int nOutsidePointCount = 0;
-
-	// get distance
-	float d0 = dist(in_poly.p[0]);
-	float d1 = dist(in_poly.p[1]);
-	float d2 = dist(in_poly.p[2]);
-
-	if (d0 >= 0)	
-		inside_points[nInsidePointCount++]	= &in_poly.p[0];
-	else
-		outside_points[nOutsidePointCount++]= &in_poly.p[0];
-	if (d1 >= 0)
-		inside_points[nInsidePointCount++] = &in_poly.p[1];
-	else 
-		outside_points[nOutsidePointCount++] = &in_poly.p[1];
-	if (d2 >= 0)
-		inside_points[nInsidePointCount++] = &in_poly.p[2];
-	else
-		outside_points[nOutsidePointCount++] = &in_poly.p[2];
-
-	// based on points layout output triangle
-	if (nInsidePointCount == 0) {
-		// triangle is out of plane, so it is invalid
-		return 0;
-	}
-
-	if (nInsidePointCount == 3) {
-		// original polygon is valid
-		out_poly1 = in_poly;
-		return 1;
-	}
-
-	if (nInsidePointCount == 1 && nOutsidePointCount == 2) {
-		// polygon gets clipped into smaller polygon
-		out_poly1.color = in_poly.color;
-		out_poly1.p[0] = *inside_points[0];
-		out_poly1.p[1] = vec4::planeIntersect(plane_p, plane_n, *inside_points[0], *outside_points[0]);
-		out_poly1.p[2] = vec4::planeIntersect(plane_p, plane_n, *inside_points[0], *outside_points[1]);
-		return 1;
-	}
-
-	if (nInsidePointCount == 2 && nOutsidePointCount == 1) {
-		// polygon gets clipped into rectangle => will be 2 output polygons
-		out_poly1.color = in_poly.color;
-		out_poly2.color = in_poly.color;
+#include <chrono>
+#include <cmath>
+#include <algorithm>
 
-		out_poly1.p[0] = *inside_points[0];
-		out_poly1.p[1] = *inside_points[1];
-		out_poly1.p[2] = vec4::planeIntersect(plane_p, plane_n, *inside_points[0], *outside_points[0]);
-
-		out_poly2.p[0] = *inside_points[1];
-		out_poly2.p[1] = out_poly1.p[2];
-		out_poly2.p[2] = vec4::planeIntersect(plane_p, plane_n, *inside_points[1], *outside_points[0]);
-		return 2;
-	}
-
-	return 0;
+size_t mesh::polyCount() const {
+	return (indexBases.empty() ? indices.size() : packedIndices.size() + wideIndices.size()) / 3;
 }
 
-bool mesh::loadObjectFile(std::string inFilename) {
-	std::ifstream f(inFilename);
-	if (!f.is_open()) return false;
-
-	std::vector<vec4> verts;
+size_t mesh::vertexCount() const {
+	return isCompact() ? packedVerts.size() : verts.size();
+}
 
-	while (!f.eof())
-	{
-		std::string line;
-		std::getline(f, line);
+bool mesh::isCompact() const {
+	return packedVerts.size() > 0;
+}
 
-		if (line.length() < 3) {
+void mesh::compact() {
+	if (isCompact() || verts.size() == 0) {
+		return;
+	}
+	packedVerts.encode(verts);
+	packedNormals.encode(normals);
+	verts = vertexStream();
+	normals = vertexStream();
+
+	// polygons are ordered for locality, so vertices of a block are mostly close together
+	size_t nPolys = polyCount();
+	size_t nBlocks = (nPolys + indexBlockPolys - 1) / indexBlockPolys;
+
+	// bases first, so that both index arrays are allocated once at their size
+	indexBases.resize(nBlocks);
+	indexOffsets.resize(nBlocks);
+	size_t nPacked = 0, nWide = 0;
+	for (size_t b = 0; b < nBlocks; b++) {
+		size_t first = b * indexBlockPolys * 3;
+		size_t last = std::min(nPolys, (b + 1) * indexBlockPolys) * 3;
+		auto bounds = std::minmax_element(indices.begin() + first, indices.begin() + last);
+		if (*bounds.second - *bounds.first > 0xFFFF) {
+			indexBases[b] = wideIndexBlock;
+			indexOffsets[b] = (unsigned int)nWide;
+			nWide += last - first;
+		}
+		else {
+			indexBases[b] = *bounds.first;
+			indexOffsets[b] = (unsigned int)nPacked;
+			nPacked += last - first;
+		}
+	}
+	packedIndices.assign(nPacked, 0);
+	wideIndices.assign(nWide, 0);
+	for (size_t b = 0; b < nBlocks; b++) {
+		size_t first = b * indexBlockPolys * 3;
+		size_t last = std::min(nPolys, (b + 1) * indexBlockPolys) * 3;
+		if (indexBases[b] == wideIndexBlock) {
+			std::copy(indices.begin() + first, indices.begin() + last, wideIndices.begin() + indexOffsets[b]);
 			continue;
 		}
+		for (size_t i = first; i < last; i++) {
+			packedIndices[indexOffsets[b] + i - first] = (unsigned short)(indices[i] - indexBases[b]);
+		}
+	}
+	indices = std::vector<unsigned int>();
+}
 
-		std::strstream s;
-		s << line;
+size_t mesh::memoryBytes() const {
+	return (verts.size() + normals.size()) * 3 * sizeof(float)
+		+ packedVerts.size() * 3 * sizeof(unsigned short) + packedNormals.size() * 2 * sizeof(short)
+		+ indices.size() * sizeof(unsigned int) + packedIndices.size() * sizeof(unsigned short)
+		+ (indexBases.size() + indexOffsets.size() + wideIndices.size()) * sizeof(unsigned int);
+}
 
-		std::string lineHeader;
-		s >> lineHeader;
-		if (s.fail()) {
-			std::cout << "Reading failed: line header" << std::endl;
-			return false;
-		}
+void mesh::computeNormals(float creaseAngle) {
+	size_t nPolys = polyCount();
+	size_t nVerts = verts.size();
+
+	// normals of polygons, length is twice the area, so bigger polygons weigh more
+	std::vector<vec4> faceNormals(nPolys);
+	std::vector<vec4> faceDirections(nPolys);
+	for (size_t f = 0; f < nPolys; f++) {
+		vec4 p0 = verts.get(indices[f * 3]);
+		vec4 line1 = verts.get(indices[f * 3 + 1]) - p0;
+		vec4 line2 = verts.get(indices[f * 3 + 2]) - p0;
+		faceNormals[f] = line1.cross(line2);
+		float length = faceNormals[f].length();
+		faceDirections[f] = length > 0.0f ? faceNormals[f] / length : vec4(0.0f, 0.0f, 0.0f);
+	}
 
-		if (lineHeader == "v") {
-			vec4 v;
-			s >> v.x >> v.y >> v.z;
-			if (s.fail()) {
-				std::cout << "Reading failed: vertex" << std::endl;
-				return false;
+	// polygon corners around every vertex
+	std::vector<unsigned int> cornerStart(nVerts + 1, 0);
+	for (unsigned int v : indices) {
+		cornerStart[v + 1]++;
+	}
+	for (size_t v = 0; v < nVerts; v++) {
+		cornerStart[v + 1] += cornerStart[v];
+	}
+	std::vector<unsigned int> corners(indices.size());
+	std::vector<unsigned int> fill(cornerStart.begin(), cornerStart.end() - 1);
+	for (size_t c = 0; c < indices.size(); c++) {
+		corners[fill[indices[c]]++] = (unsigned int)c;
+	}
+
+	float creaseCos = cosf(creaseAngle * 3.14159265f / 180.0f);
+	normals.resize(nVerts);
+	std::vector<unsigned int> split;
+	for (size_t v = 0; v < nVerts; v++) {
+		// corners with equal normal share a vertex, first of them keeps the original one
+		split.clear();
+		for (unsigned int c = cornerStart[v]; c < cornerStart[v + 1]; c++) {
+			vec4 face = faceDirections[corners[c] / 3];
+			vec4 sum = { 0.0f, 0.0f, 0.0f };
+			for (unsigned int o = cornerStart[v]; o < cornerStart[v + 1]; o++) {
+				vec4 other = faceDirections[corners[o] / 3];
+				if (o == c || face.dot(other) >= creaseCos) {
+					sum = sum + faceNormals[corners[o] / 3];
+				}
 			}
-			verts.push_back(v);
-		}
-		else if (lineHeader == "f") {
-			int count = std::count(line.begin(), line.end(), '/');
-
-			if (count == 0) {
-				int v[3];
-				s >> v[0] >> v[1] >> v[2];
-				if (s.fail()) {
-					std::cout << "Reading failed: polygon" << std::endl;
-					return false;
+			float length = sum.length();
+			vec4 normal = length > 0.0f ? sum / length : vec4(0.0f, 0.0f, 0.0f);
+
+			unsigned int target = (unsigned int)v;
+			bool found = false;
+			for (unsigned int s : split) {
+				if (normals.x[s] == normal.x && normals.y[s] == normal.y && normals.z[s] == normal.z) {
+					target = s;
+					found = true;
+					break;
 				}
-				polygon poly;
-				poly.p[0] = verts[v[0] - 1];
-				poly.p[1] = verts[v[1] - 1];
-				poly.p[2] = verts[v[2] - 1];
-
-				this->polys.push_back(poly);
 			}
-			else if (count == 6 || count == 8) {
-				char junkChar;
-				int junkInt;
-
-				int v[3];
-				s >> v[0] >> junkChar >> junkInt >> junkChar >> junkInt >>
-					v[1] >> junkChar >> junkInt >> junkChar >> junkInt >>
-					v[2];
-				if (s.fail()) {
-					std::cout << "Reading failed: polygon" << std::endl;
-					return false;
+			if (!found) {
+				if (!split.empty()) {
+					target = (unsigned int)verts.size();
+					verts.push_back(verts.get(v));
+					normals.push_back(normal);
 				}
-				polygon poly;
-				poly.p[0] = verts[v[0] - 1];
-				poly.p[1] = verts[v[1] - 1];
-				poly.p[2] = verts[v[2] - 1];
-
-				this->polys.push_back(poly);
-			} 
-			else {
-				std::cout << "Unknown obj file" << std::endl;
-				return false;
+				normals.x[target] = normal.x;
+				normals.y[target] = normal.y;
+				normals.z[target] = normal.z;
+				split.push_back(target);
 			}
-		}
-		else {
-			// std::cout << "Unknown line header " << lineHeader << std::endl;
+			indices[corners[c]] = target;
 		}
 	}
-	return true;
+}
 
+double loadStats::megabytesPerSecond() const {
+	return seconds > 0.0 ? bytes / (1024.0 * 1024.0) / seconds : 0.0;
+}
+
+double loadStats::facesPerSecond() const {
+	return seconds > 0.0 ? faces / seconds : 0.0;
+}
+
+bool mesh::loadObjectFile(std::string inFilename, int threadCount) {
+	PROFILE_ZONE("load obj");
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	MappedFile file;
+	if (!file.open(inFilename)) return false;
+
+	verts.clear();
+	normals.clear();
+	indices.clear();
+
+	if (!parseObj(file.data(), file.data() + file.size(), *this, threadCount)) {
+		return false;
+	}
+	if (normals.size() != verts.size()) {
+		computeNormals();
+	}
+
+	auto elapsed = std::chrono::high_resolution_clock::now() - startTime;
+	lastLoad.bytes = file.size();
+	lastLoad.faces = polyCount();
+	lastLoad.seconds = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() / 1e6;
+	lastLoad.fromCache = false;
+	return true;
 }
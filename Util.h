@@ -7,6 +7,7 @@
 
 #include "vec4.h"
 #include "mat4x4.h"
+#include "VertexTransform.h"
 
 #include <vector>
 #include <string>
@@ -16,14 +17,93 @@ class polygon
 public:
 	vec4 p[3];
 	unsigned int color = 0;
+};
+
+// timings of mesh loading, to keep track of startup cost
+class loadStats
+{
+public:
+	size_t bytes = 0;		// size of source file
+	size_t faces = 0;		// polygons loaded
+	double seconds = 0.0;	// time spent in loader
+	bool fromCache = false;	// loaded from binary mesh cache instead of obj
 
-	static int clipAgainstPlane(vec4 plane_p, vec4 plane_n, polygon& in_tri, polygon& out_tri1, polygon& out_tri2);
+	double megabytesPerSecond() const;
+	double facesPerSecond() const;
 };
 
+// polygons meeting at larger angle get separate vertex normals
+const float defaultCreaseAngle = 45.0f;
+
+// polygons sharing one base of 16 bit indices in compact meshes
+const size_t indexBlockPolys = 64;
+// base of block whose vertices do not fit into 16 bits, its indices are kept whole in mesh::wideIndices
+const unsigned int wideIndexBlock = 0x80000000u;
+
 class mesh
 {
 public:
-	std::vector<polygon> polys;
+	vertexStream verts;					// unique vertices, shared between polygons
+	vertexStream normals;				// unit normal of every vertex
+	std::vector<unsigned int> indices;	// 3 vertex indices per polygon
+
+	// compact storage made by compact(), used instead of the streams above when filled
+	quantizedStream packedVerts;		// positions quantized against mesh bounds
+	octahedralStream packedNormals;
+	std::vector<unsigned short> packedIndices;	// index minus base of its block, only blocks which fit
+	std::vector<unsigned int> indexBases;		// lowest index of every block of indexBlockPolys polygons, or wideIndexBlock
+	std::vector<unsigned int> indexOffsets;		// first index of every block in packedIndices, or in wideIndices
+	std::vector<unsigned int> wideIndices;		// full indices of blocks which do not fit
+
+	loadStats lastLoad;					// statistics of last load from obj file or mesh cache
+
+	// number of polygons in index buffer
+	size_t polyCount() const;
+
+	// number of vertices, also of compact mesh
+	size_t vertexCount() const;
+
+	// positions and normals are in compact form
+	bool isCompact() const;
+
+	// vertex indices of polygon, also of compact mesh
+	void polyIndices(size_t poly, unsigned int out[3]) const {
+		if (indexBases.empty()) {
+			out[0] = indices[poly * 3];
+			out[1] = indices[poly * 3 + 1];
+			out[2] = indices[poly * 3 + 2];
+			return;
+		}
+		size_t block = poly / indexBlockPolys;
+		size_t at = indexOffsets[block] + poly % indexBlockPolys * 3;
+		unsigned int base = indexBases[block];
+		if (base == wideIndexBlock) {
+			out[0] = wideIndices[at];
+			out[1] = wideIndices[at + 1];
+			out[2] = wideIndices[at + 2];
+			return;
+		}
+		out[0] = base + packedIndices[at];
+		out[1] = base + packedIndices[at + 1];
+		out[2] = base + packedIndices[at + 2];
+	}
+
+	// replace positions by 16 bit quantized ones, normals by octahedral ones, and indices
+	// by 16 bit offsets from base of their block, blocks spanning more than 65536 vertices
+	// keep only 32 bit indices. Float streams are released, so mesh can only be rendered
+	// afterwards, it is decoded on the fly. Meant to be the last step of loading
+	void compact();
+
+	// bytes of vertex and index data
+	size_t memoryBytes() const;
+
+	// replace normals by area weighted average of normals of polygons around vertex,
+	// vertices on edges sharper than creaseAngle (degrees) are split, so that
+	// every side of the edge gets its own normal
+	void computeNormals(float creaseAngle = defaultCreaseAngle);
 
-	bool loadObjectFile(std::string sFilename);
+	// load obj file through memory mapping, fills lastLoad on success,
+	// normals missing in file are computed. Large files are parsed on
+	// threadCount threads, 0 - one per hardware thread
+	bool loadObjectFile(std::string sFilename, int threadCount = 0);
 };
@@ -0,0 +1,215 @@
+/* Short description: polygon reordering for post-transform vertex cache
+ * (Forsyth), and average cache miss ratio of index buffers
+ */
+
+#include "VertexCache.h"
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// vertex of polygon emitted last, a bit lower than the next ones, so that
+// strips do not turn back on themselves
+static const float lastPolyScore = 0.75f;
+static const float cacheDecayPower = 1.5f;
+// favours vertices with few polygons left, so lonely polygons are not left behind
+static const float valenceBoostScale = 2.0f;
+static const float valenceBoostPower = 0.5f;
+
+// vertices with more polygons left than this get the same valence boost
+static const unsigned int maxValence = 32;
+
+// parts of vertex score by position in LRU cache and by number of polygons left to emit
+class vertexScoreTables
+{
+public:
+	float cache[vertexCacheSize];
+	float valence[maxValence + 1];
+
+	vertexScoreTables() {
+		for (size_t i = 0; i < vertexCacheSize; i++) {
+			float scale = 1.0f / (float)(vertexCacheSize - 3);
+			cache[i] = i < 3 ? lastPolyScore : std::pow(1.0f - (float)(i - 3) * scale, cacheDecayPower);
+		}
+		valence[0] = 0.0f;
+		for (unsigned int i = 1; i <= maxValence; i++) {
+			valence[i] = valenceBoostScale * std::pow((float)i, -valenceBoostPower);
+		}
+	}
+};
+
+static const vertexScoreTables scoreTables;
+
+// score of vertex at position in LRU cache (-1 if not in it) with polygons left to emit
+static inline float vertexScore(int cachePosition, unsigned int remaining) {
+	if (remaining == 0) {
+		return -1.0f;
+	}
+	float score = cachePosition >= 0 ? scoreTables.cache[cachePosition] : 0.0f;
+	return score + scoreTables.valence[std::min(remaining, maxValence)];
+}
+
+void optimizeVertexCache(unsigned int* indices, size_t polyCount, size_t vertexCount, const unsigned int* cached, size_t cachedCount) {
+	if (polyCount < 2) {
+		return;
+	}
+
+	// polygons of every vertex, the first remaining[v] of them are not emitted yet
+	std::vector<unsigned int> remaining(vertexCount, 0);
+	for (size_t i = 0; i < polyCount * 3; i++) {
+		remaining[indices[i]]++;
+	}
+	std::vector<unsigned int> adjacencyStart(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++) {
+		adjacencyStart[v + 1] = adjacencyStart[v] + remaining[v];
+	}
+	std::vector<unsigned int> adjacency(polyCount * 3);
+	std::vector<unsigned int> filled(vertexCount, 0);
+	for (size_t i = 0; i < polyCount * 3; i++) {
+		unsigned int v = indices[i];
+		adjacency[adjacencyStart[v] + filled[v]++] = (unsigned int)(i / 3);
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> scores(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++) {
+		scores[v] = vertexScore(-1, remaining[v]);
+	}
+	std::vector<float> polyScores(polyCount);
+	for (size_t f = 0; f < polyCount; f++) {
+		polyScores[f] = scores[indices[f * 3]] + scores[indices[f * 3 + 1]] + scores[indices[f * 3 + 2]];
+	}
+
+	std::vector<unsigned char> emitted(polyCount, 0);
+	std::vector<unsigned int> order;
+	order.reserve(polyCount);
+
+	// LRU cache, 3 more entries for vertices of polygon pushed in before the oldest fall out
+	unsigned int cache[vertexCacheSize + 3];
+	size_t cacheUsed = 0;
+	size_t scanFrom = 0;
+	int best = -1;
+
+	// best polygon around cached vertices, -1 if they have none left
+	auto bestAroundCache = [&]() {
+		int found = -1;
+		float bestScore = -1.0f;
+		for (size_t i = 0; i < cacheUsed; i++) {
+			unsigned int v = cache[i];
+			for (unsigned int a = adjacencyStart[v]; a < adjacencyStart[v] + remaining[v]; a++) {
+				unsigned int f = adjacency[a];
+				if (polyScores[f] > bestScore) {
+					bestScore = polyScores[f];
+					found = (int)f;
+				}
+			}
+		}
+		return found;
+	};
+
+	// vertices left in cache by previous polygons score as if this buffer put them there
+	for (size_t i = 0; i < cachedCount && cacheUsed < vertexCacheSize; i++) {
+		unsigned int v = cached[i];
+		if (std::find(cache, cache + cacheUsed, v) != cache + cacheUsed) {
+			continue;
+		}
+		cachePosition[v] = (int)cacheUsed;
+		cache[cacheUsed++] = v;
+		float score = vertexScore(cachePosition[v], remaining[v]);
+		float delta = score - scores[v];
+		scores[v] = score;
+		for (unsigned int a = adjacencyStart[v]; a < adjacencyStart[v] + remaining[v]; a++) {
+			polyScores[adjacency[a]] += delta;
+		}
+	}
+	best = bestAroundCache();
+
+	while (order.size() < polyCount) {
+		if (best < 0) {
+			// nothing left around cached vertices, best of all remaining polygons
+			float bestScore = -1.0f;
+			while (emitted[scanFrom]) scanFrom++;
+			for (size_t f = scanFrom; f < polyCount; f++) {
+				if (!emitted[f] && polyScores[f] > bestScore) {
+					bestScore = polyScores[f];
+					best = (int)f;
+				}
+			}
+		}
+
+		emitted[best] = 1;
+		order.push_back((unsigned int)best);
+
+		// vertices of emitted polygon go to the front of cache, without duplicates
+		unsigned int newCache[vertexCacheSize + 3];
+		size_t newUsed = 0;
+		for (int k = 0; k < 3; k++) {
+			unsigned int v = indices[best * 3 + k];
+			if (std::find(newCache, newCache + newUsed, v) != newCache + newUsed) {
+				continue;
+			}
+			newCache[newUsed++] = v;
+
+			// polygon is no longer waiting on its vertices
+			unsigned int* first = &adjacency[adjacencyStart[v]];
+			unsigned int* last = first + remaining[v];
+			unsigned int* found = std::find(first, last, (unsigned int)best);
+			while (found != last) {
+				*found = *--last;
+				remaining[v]--;
+				found = std::find(first, last, (unsigned int)best);
+			}
+		}
+		size_t added = newUsed;
+		for (size_t i = 0; i < cacheUsed; i++) {
+			unsigned int v = cache[i];
+			if (std::find(newCache, newCache + added, v) == newCache + added) {
+				newCache[newUsed++] = v;
+			}
+		}
+
+		// scores change only for vertices which were or are in cache
+		for (size_t i = 0; i < newUsed; i++) {
+			unsigned int v = newCache[i];
+			cachePosition[v] = i < vertexCacheSize ? (int)i : -1;
+			float score = vertexScore(cachePosition[v], remaining[v]);
+			float delta = score - scores[v];
+			scores[v] = score;
+			for (unsigned int a = adjacencyStart[v]; a < adjacencyStart[v] + remaining[v]; a++) {
+				polyScores[adjacency[a]] += delta;
+			}
+		}
+		cacheUsed = std::min(newUsed, vertexCacheSize);
+		std::copy(newCache, newCache + cacheUsed, cache);
+
+		// next polygon is the best one around cached vertices
+		best = bestAroundCache();
+	}
+
+	std::vector<unsigned int> reordered(polyCount * 3);
+	for (size_t i = 0; i < polyCount; i++) {
+		reordered[i * 3 + 0] = indices[order[i] * 3 + 0];
+		reordered[i * 3 + 1] = indices[order[i] * 3 + 1];
+		reordered[i * 3 + 2] = indices[order[i] * 3 + 2];
+	}
+	std::copy(reordered.begin(), reordered.end(), indices);
+}
+
+float vertexCacheMissRatio(const unsigned int* indices, size_t polyCount, size_t vertexCount, size_t cacheSize) {
+	if (polyCount == 0) {
+		return 0.0f;
+	}
+
+	// vertex is in FIFO cache if fewer than cacheSize misses happened since it was loaded
+	const size_t notLoaded = (size_t)-1;
+	std::vector<size_t> loadedAt(vertexCount, notLoaded);
+	size_t misses = 0;
+	for (size_t i = 0; i < polyCount * 3; i++) {
+		unsigned int v = indices[i];
+		if (loadedAt[v] == notLoaded || misses - loadedAt[v] >= cacheSize) {
+			loadedAt[v] = misses;
+			misses++;
+		}
+	}
+	return (float)misses / (float)polyCount;
+}
@@ -0,0 +1,22 @@
+/* Short description: polygon reordering for post-transform vertex cache
+ * (Forsyth), and average cache miss ratio of index buffers
+ */
+
+#pragma once
+
+#include <cstddef>
+
+// entries of cache the reordering optimizes for, and of cache used to measure it
+const size_t vertexCacheSize = 32;
+
+// reorder polygons of index buffer so that consecutive polygons reuse recently used
+// vertices, with scores of Forsyth's linear-speed optimizer. Polygons keep their
+// vertex order, indices must be in [0, vertexCount). Cache can start with cachedCount
+// vertices left by polygons drawn before (most recent first), so runs of buffers
+// optimized one after another continue where the previous one ended
+void optimizeVertexCache(unsigned int* indices, size_t polyCount, size_t vertexCount,
+	const unsigned int* cached = nullptr, size_t cachedCount = 0);
+
+// average cache miss ratio: vertices missing in FIFO cache of cacheSize entries,
+// per polygon. 3 - no reuse at all, 0.5 - best possible for large regular meshes
+float vertexCacheMissRatio(const unsigned int* indices, size_t polyCount, size_t vertexCount, size_t cacheSize = vertexCacheSize);
@@ -0,0 +1,594 @@
+/* Short description: structure of arrays vertex storage and batch
+ * transform of vertices from object into world, camera and screen space,
+ * with SSE / AVX2 kernels picked at runtime, quantized positions and
+ * octahedral normals are decoded on the fly
+ */
+
+#include "VertexTransform.h"
+
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define VERTEX_TRANSFORM_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+size_t vertexStream::size() const {
+	return x.size();
+}
+
+void vertexStream::resize(size_t n) {
+	x.resize(n);
+	y.resize(n);
+	z.resize(n);
+}
+
+void vertexStream::clear() {
+	x.clear();
+	y.clear();
+	z.clear();
+}
+
+void vertexStream::push_back(const vec4& v) {
+	x.push_back(v.x);
+	y.push_back(v.y);
+	z.push_back(v.z);
+}
+
+vec4 vertexStream::get(size_t i) const {
+	return { x[i], y[i], z[i] };
+}
+
+size_t quantizedStream::size() const {
+	return x.size();
+}
+
+void quantizedStream::clear() {
+	x.clear();
+	y.clear();
+	z.clear();
+}
+
+void quantizedStream::encode(const vertexStream& in) {
+	size_t n = in.size();
+	const std::vector<float>* axes[3] = { &in.x, &in.y, &in.z };
+	std::vector<unsigned short>* outAxes[3] = { &x, &y, &z };
+	for (int c = 0; c < 3; c++) {
+		const std::vector<float>& values = *axes[c];
+		std::vector<unsigned short>& quantized = *outAxes[c];
+		quantized.resize(n);
+		if (n == 0) {
+			continue;
+		}
+		auto bounds = std::minmax_element(values.begin(), values.end());
+		offset[c] = *bounds.first;
+		scale[c] = (*bounds.second - *bounds.first) / 65535.0f;
+		float inverse = scale[c] > 0.0f ? 1.0f / scale[c] : 0.0f;
+		for (size_t i = 0; i < n; i++) {
+			float q = std::floor((values[i] - offset[c]) * inverse + 0.5f);
+			quantized[i] = (unsigned short)std::min(std::max(q, 0.0f), 65535.0f);
+		}
+	}
+}
+
+vec4 quantizedStream::get(size_t i) const {
+	return { offset[0] + x[i] * scale[0], offset[1] + y[i] * scale[1], offset[2] + z[i] * scale[2] };
+}
+
+mat4x4 quantizedStream::dequantizeMatrix() const {
+	mat4x4 m;
+	for (int c = 0; c < 3; c++) {
+		m.m[c][c] = scale[c];
+		m.m[3][c] = offset[c];
+	}
+	return m;
+}
+
+size_t octahedralStream::size() const {
+	return u.size();
+}
+
+void octahedralStream::clear() {
+	u.clear();
+	v.clear();
+}
+
+void octahedralStream::encode(const vertexStream& in) {
+	size_t n = in.size();
+	u.resize(n);
+	v.resize(n);
+	for (size_t i = 0; i < n; i++) {
+		// project on octahedron |x| + |y| + |z| = 1, lower half is folded over the upper one
+		float sum = std::fabs(in.x[i]) + std::fabs(in.y[i]) + std::fabs(in.z[i]);
+		if (!(sum > 0.0f)) {
+			u[i] = zeroNormal;
+			v[i] = zeroNormal;
+			continue;
+		}
+		float ox = in.x[i] / sum, oy = in.y[i] / sum;
+		if (in.z[i] < 0.0f) {
+			float fx = (1.0f - std::fabs(oy)) * (ox >= 0.0f ? 1.0f : -1.0f);
+			float fy = (1.0f - std::fabs(ox)) * (oy >= 0.0f ? 1.0f : -1.0f);
+			ox = fx;
+			oy = fy;
+		}
+		u[i] = (short)std::floor(ox * 32767.0f + 0.5f);
+		v[i] = (short)std::floor(oy * 32767.0f + 0.5f);
+	}
+}
+
+// unnormalized normal of octahedral code, the same arithmetic as lightVertices
+static inline void decodeOctahedral(short qu, short qv, float& x, float& y, float& z) {
+	x = qu * (1.0f / 32767.0f);
+	y = qv * (1.0f / 32767.0f);
+	z = 1.0f - std::fabs(x) - std::fabs(y);
+	float fold = std::max(-z, 0.0f);
+	x += x >= 0.0f ? -fold : fold;
+	y += y >= 0.0f ? -fold : fold;
+}
+
+vec4 octahedralStream::get(size_t i) const {
+	if (u[i] == zeroNormal && v[i] == zeroNormal) {
+		return vec4(0.0f, 0.0f, 0.0f);
+	}
+	float x, y, z;
+	decodeOctahedral(u[i], v[i], x, y, z);
+	float inverse = 1.0f / std::sqrt(x * x + y * y + z * z);
+	return vec4(x * inverse, y * inverse, z * inverse);
+}
+
+void transformedStream::resize(size_t n) {
+	world.resize(n);
+	view.resize(n);
+	screen.resize(n);
+	clipFlags.resize(n);
+}
+
+// everything kernels need, pointers are already offset to the first vertex
+struct transformArgs
+{
+	const float* inX; const float* inY; const float* inZ;
+	const unsigned short* packedX; const unsigned short* packedY; const unsigned short* packedZ;	// instead of in, if not null
+	float* worldX; float* worldY; float* worldZ;
+	float* viewX; float* viewY; float* viewZ;
+	float* screenX; float* screenY; float* screenZ;
+	unsigned char* clipFlags;
+	const mat4x4* world; const mat4x4* view; const mat4x4* proj;
+	float halfWidth, halfHeight, guardBand;
+};
+
+// reference kernel, same math as mat4x4 * vec4 followed by divide and viewport scale
+static void transformScalar(const transformArgs& a, size_t begin, size_t end) {
+	const float(*W)[4] = a.world->m;
+	const float(*V)[4] = a.view->m;
+	const float(*P)[4] = a.proj->m;
+
+	for (size_t i = begin; i < end; i++) {
+		float x, y, z;
+		if (a.packedX) {
+			x = (float)a.packedX[i]; y = (float)a.packedY[i]; z = (float)a.packedZ[i];
+		}
+		else {
+			x = a.inX[i]; y = a.inY[i]; z = a.inZ[i];
+		}
+
+		// w of world and view vertices stays 1 for affine transforms
+		float wx = x * W[0][0] + y * W[1][0] + z * W[2][0] + W[3][0];
+		float wy = x * W[0][1] + y * W[1][1] + z * W[2][1] + W[3][1];
+		float wz = x * W[0][2] + y * W[1][2] + z * W[2][2] + W[3][2];
+
+		float vx = wx * V[0][0] + wy * V[1][0] + wz * V[2][0] + V[3][0];
+		float vy = wx * V[0][1] + wy * V[1][1] + wz * V[2][1] + V[3][1];
+		float vz = wx * V[0][2] + wy * V[1][2] + wz * V[2][2] + V[3][2];
+
+		float cx = vx * P[0][0] + vy * P[1][0] + vz * P[2][0] + P[3][0];
+		float cy = vx * P[0][1] + vy * P[1][1] + vz * P[2][1] + P[3][1];
+		float cz = vx * P[0][2] + vy * P[1][2] + vz * P[2][2] + P[3][2];
+		float cw = vx * P[0][3] + vy * P[1][3] + vz * P[2][3] + P[3][3];
+
+		a.worldX[i] = wx; a.worldY[i] = wy; a.worldZ[i] = wz;
+		a.viewX[i] = vx; a.viewY[i] = vy; a.viewZ[i] = vz;
+
+		float guardW = a.guardBand * cw;
+		unsigned char flags = 0;
+		if (cz < 0.0f) flags |= CLIP_NEAR;
+		if (cz > cw) flags |= CLIP_FAR;
+		if (cx < -cw) flags |= CLIP_LEFT;
+		if (cx > cw) flags |= CLIP_RIGHT;
+		if (cy < -cw) flags |= CLIP_BOTTOM;
+		if (cy > cw) flags |= CLIP_TOP;
+		if (cx < -guardW || cx > guardW) flags |= CLIP_GUARD_X;
+		if (cy < -guardW || cy > guardW) flags |= CLIP_GUARD_Y;
+		a.clipFlags[i] = flags;
+
+		// divide, invert x and y, offset into visible space and scale to pixels
+		a.screenX[i] = (1.0f - cx / cw) * a.halfWidth;
+		a.screenY[i] = (1.0f - cy / cw) * a.halfHeight;
+		a.screenZ[i] = cz / cw;
+	}
+}
+
+#ifdef VERTEX_TRANSFORM_X86
+
+// 4 coordinates as floats, 16 bit ones are widened in registers
+static inline __m128 loadSSE(const float* in, const unsigned short* packed, size_t i) {
+	if (packed) {
+		__m128i q = _mm_loadl_epi64((const __m128i*)(packed + i));
+		return _mm_cvtepi32_ps(_mm_unpacklo_epi16(q, _mm_setzero_si128()));
+	}
+	return _mm_loadu_ps(in + i);
+}
+
+TARGET_AVX2 static inline __m256 loadAVX2(const float* in, const unsigned short* packed, size_t i) {
+	if (packed) {
+		__m128i q = _mm_loadu_si128((const __m128i*)(packed + i));
+		return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(q));
+	}
+	return _mm256_loadu_ps(in + i);
+}
+
+// 4 vertices per iteration, matrix elements are broadcast into registers
+static size_t transformSSE(const transformArgs& a, size_t count) {
+	const float(*W)[4] = a.world->m;
+	const float(*V)[4] = a.view->m;
+	const float(*P)[4] = a.proj->m;
+
+	__m128 w[4][3], v[4][3], p[4][4];
+	for (int r = 0; r < 4; r++) {
+		for (int c = 0; c < 3; c++) {
+			w[r][c] = _mm_set1_ps(W[r][c]);
+			v[r][c] = _mm_set1_ps(V[r][c]);
+		}
+		for (int c = 0; c < 4; c++) {
+			p[r][c] = _mm_set1_ps(P[r][c]);
+		}
+	}
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 halfWidth = _mm_set1_ps(a.halfWidth);
+	__m128 halfHeight = _mm_set1_ps(a.halfHeight);
+	__m128 guardBand = _mm_set1_ps(a.guardBand);
+	__m128 flagBits[8];
+	for (int b = 0; b < 8; b++) {
+		flagBits[b] = _mm_castsi128_ps(_mm_set1_epi32(1 << b));
+	}
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 x = loadSSE(a.inX, a.packedX, i);
+		__m128 y = loadSSE(a.inY, a.packedY, i);
+		__m128 z = loadSSE(a.inZ, a.packedZ, i);
+
+		__m128 wo[3], vo[3], co[4];
+		for (int c = 0; c < 3; c++) {
+			wo[c] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, w[0][c]), _mm_mul_ps(y, w[1][c])), _mm_mul_ps(z, w[2][c])), w[3][c]);
+		}
+		for (int c = 0; c < 3; c++) {
+			vo[c] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(wo[0], v[0][c]), _mm_mul_ps(wo[1], v[1][c])), _mm_mul_ps(wo[2], v[2][c])), v[3][c]);
+		}
+		for (int c = 0; c < 4; c++) {
+			co[c] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vo[0], p[0][c]), _mm_mul_ps(vo[1], p[1][c])), _mm_mul_ps(vo[2], p[2][c])), p[3][c]);
+		}
+
+		_mm_storeu_ps(a.worldX + i, wo[0]);
+		_mm_storeu_ps(a.worldY + i, wo[1]);
+		_mm_storeu_ps(a.worldZ + i, wo[2]);
+		_mm_storeu_ps(a.viewX + i, vo[0]);
+		_mm_storeu_ps(a.viewY + i, vo[1]);
+		_mm_storeu_ps(a.viewZ + i, vo[2]);
+		_mm_storeu_ps(a.screenX + i, _mm_mul_ps(_mm_sub_ps(one, _mm_div_ps(co[0], co[3])), halfWidth));
+		_mm_storeu_ps(a.screenY + i, _mm_mul_ps(_mm_sub_ps(one, _mm_div_ps(co[1], co[3])), halfHeight));
+		_mm_storeu_ps(a.screenZ + i, _mm_div_ps(co[2], co[3]));
+
+		// every comparison gives all ones lane mask, keep its flag bit
+		__m128 cw = co[3];
+		__m128 negW = _mm_sub_ps(zero, cw);
+		__m128 guardW = _mm_mul_ps(guardBand, cw);
+		__m128 negGuardW = _mm_sub_ps(zero, guardW);
+		__m128 flags = _mm_and_ps(_mm_cmplt_ps(co[2], zero), flagBits[0]);
+		flags = _mm_or_ps(flags, _mm_and_ps(_mm_cmpgt_ps(co[2], cw), flagBits[1]));
+		flags = _mm_or_ps(flags, _mm_and_ps(_mm_cmplt_ps(co[0], negW), flagBits[2]));
+		flags = _mm_or_ps(flags, _mm_and_ps(_mm_cmpgt_ps(co[0], cw), flagBits[3]));
+		flags = _mm_or_ps(flags, _mm_and_ps(_mm_cmplt_ps(co[1], negW), flagBits[4]));
+		flags = _mm_or_ps(flags, _mm_and_ps(_mm_cmpgt_ps(co[1], cw), flagBits[5]));
+		flags = _mm_or_ps(flags, _mm_and_ps(_mm_or_ps(_mm_cmplt_ps(co[0], negGuardW), _mm_cmpgt_ps(co[0], guardW)), flagBits[6]));
+		flags = _mm_or_ps(flags, _mm_and_ps(_mm_or_ps(_mm_cmplt_ps(co[1], negGuardW), _mm_cmpgt_ps(co[1], guardW)), flagBits[7]));
+
+		// pack 32 bit lanes into bytes
+		__m128i flags16 = _mm_packs_epi32(_mm_castps_si128(flags), _mm_castps_si128(flags));
+		__m128i flags8 = _mm_packus_epi16(flags16, flags16);
+		int packed = _mm_cvtsi128_si32(flags8);
+		std::memcpy(a.clipFlags + i, &packed, 4);
+	}
+	return i;
+}
+
+// 8 vertices per iteration, same operation order as scalar kernel
+TARGET_AVX2 static size_t transformAVX2(const transformArgs& a, size_t count) {
+	const float(*W)[4] = a.world->m;
+	const float(*V)[4] = a.view->m;
+	const float(*P)[4] = a.proj->m;
+
+	__m256 w[4][3], v[4][3], p[4][4];
+	for (int r = 0; r < 4; r++) {
+		for (int c = 0; c < 3; c++) {
+			w[r][c] = _mm256_set1_ps(W[r][c]);
+			v[r][c] = _mm256_set1_ps(V[r][c]);
+		}
+		for (int c = 0; c < 4; c++) {
+			p[r][c] = _mm256_set1_ps(P[r][c]);
+		}
+	}
+	__m256 zero = _mm256_setzero_ps();
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 halfWidth = _mm256_set1_ps(a.halfWidth);
+	__m256 halfHeight = _mm256_set1_ps(a.halfHeight);
+	__m256 guardBand = _mm256_set1_ps(a.guardBand);
+	__m256 flagBits[8];
+	for (int b = 0; b < 8; b++) {
+		flagBits[b] = _mm256_castsi256_ps(_mm256_set1_epi32(1 << b));
+	}
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 x = loadAVX2(a.inX, a.packedX, i);
+		__m256 y = loadAVX2(a.inY, a.packedY, i);
+		__m256 z = loadAVX2(a.inZ, a.packedZ, i);
+
+		__m256 wo[3], vo[3], co[4];
+		for (int c = 0; c < 3; c++) {
+			wo[c] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, w[0][c]), _mm256_mul_ps(y, w[1][c])), _mm256_mul_ps(z, w[2][c])), w[3][c]);
+		}
+		for (int c = 0; c < 3; c++) {
+			vo[c] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(wo[0], v[0][c]), _mm256_mul_ps(wo[1], v[1][c])), _mm256_mul_ps(wo[2], v[2][c])), v[3][c]);
+		}
+		for (int c = 0; c < 4; c++) {
+			co[c] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vo[0], p[0][c]), _mm256_mul_ps(vo[1], p[1][c])), _mm256_mul_ps(vo[2], p[2][c])), p[3][c]);
+		}
+
+		_mm256_storeu_ps(a.worldX + i, wo[0]);
+		_mm256_storeu_ps(a.worldY + i, wo[1]);
+		_mm256_storeu_ps(a.worldZ + i, wo[2]);
+		_mm256_storeu_ps(a.viewX + i, vo[0]);
+		_mm256_storeu_ps(a.viewY + i, vo[1]);
+		_mm256_storeu_ps(a.viewZ + i, vo[2]);
+		_mm256_storeu_ps(a.screenX + i, _mm256_mul_ps(_mm256_sub_ps(one, _mm256_div_ps(co[0], co[3])), halfWidth));
+		_mm256_storeu_ps(a.screenY + i, _mm256_mul_ps(_mm256_sub_ps(one, _mm256_div_ps(co[1], co[3])), halfHeight));
+		_mm256_storeu_ps(a.screenZ + i, _mm256_div_ps(co[2], co[3]));
+
+		// every comparison gives all ones lane mask, keep its flag bit
+		__m256 cw = co[3];
+		__m256 negW = _mm256_sub_ps(zero, cw);
+		__m256 guardW = _mm256_mul_ps(guardBand, cw);
+		__m256 negGuardW = _mm256_sub_ps(zero, guardW);
+		__m256 flags = _mm256_and_ps(_mm256_cmp_ps(co[2], zero, _CMP_LT_OQ), flagBits[0]);
+		flags = _mm256_or_ps(flags, _mm256_and_ps(_mm256_cmp_ps(co[2], cw, _CMP_GT_OQ), flagBits[1]));
+		flags = _mm256_or_ps(flags, _mm256_and_ps(_mm256_cmp_ps(co[0], negW, _CMP_LT_OQ), flagBits[2]));
+		flags = _mm256_or_ps(flags, _mm256_and_ps(_mm256_cmp_ps(co[0], cw, _CMP_GT_OQ), flagBits[3]));
+		flags = _mm256_or_ps(flags, _mm256_and_ps(_mm256_cmp_ps(co[1], negW, _CMP_LT_OQ), flagBits[4]));
+		flags = _mm256_or_ps(flags, _mm256_and_ps(_mm256_cmp_ps(co[1], cw, _CMP_GT_OQ), flagBits[5]));
+		flags = _mm256_or_ps(flags, _mm256_and_ps(_mm256_or_ps(_mm256_cmp_ps(co[0], negGuardW, _CMP_LT_OQ), _mm256_cmp_ps(co[0], guardW, _CMP_GT_OQ)), flagBits[6]));
+		flags = _mm256_or_ps(flags, _mm256_and_ps(_mm256_or_ps(_mm256_cmp_ps(co[1], negGuardW, _CMP_LT_OQ), _mm256_cmp_ps(co[1], guardW, _CMP_GT_OQ)), flagBits[7]));
+
+		// pack 32 bit lanes into bytes
+		__m256i flags32 = _mm256_castps_si256(flags);
+		__m128i flags16 = _mm_packs_epi32(_mm256_castsi256_si128(flags32), _mm256_extracti128_si256(flags32, 1));
+		__m128i flags8 = _mm_packus_epi16(flags16, flags16);
+		_mm_storel_epi64((__m128i*)(a.clipFlags + i), flags8);
+	}
+	_mm256_zeroupper();
+	return i;
+}
+
+static transformPath detectTransformPath() {
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	bool avx2 = false;
+	if (maxLeaf >= 7 && osxsave && avx) {
+		// OS has to save YMM registers on context switch
+		bool ymmEnabled = (_xgetbv(0) & 0x6) == 0x6;
+		__cpuidex(info, 7, 0);
+		avx2 = ymmEnabled && (info[1] & (1 << 5)) != 0;
+	}
+	if (avx2) return TRANSFORM_AVX2;
+	if (sse2) return TRANSFORM_SSE;
+	return TRANSFORM_SCALAR;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return TRANSFORM_AVX2;
+	if (__builtin_cpu_supports("sse2")) return TRANSFORM_SSE;
+	return TRANSFORM_SCALAR;
+#endif
+}
+
+#else
+
+static transformPath detectTransformPath() {
+	return TRANSFORM_SCALAR;
+}
+
+#endif
+
+transformPath bestTransformPath() {
+	static const transformPath path = detectTransformPath();
+	return path;
+}
+
+const char* transformPathName(transformPath path) {
+	switch (path)
+	{
+	case TRANSFORM_SSE:		return "SSE";
+	case TRANSFORM_AVX2:	return "AVX2";
+	default:				return "scalar";
+	}
+}
+
+float effectiveGuardBand(float guardBand, float screenWidth, float screenHeight) {
+	// polygon inside of guard band spans up to guardBand screen sizes
+	float screenSize = std::max(screenWidth, screenHeight);
+	if (!(screenSize > 0.0f)) {
+		return guardBand;
+	}
+	float largest = ((float)maxRasterSize - 1.0f) / screenSize;
+	return std::max(1.0f, std::min(guardBand, largest));
+}
+
+// output pointers and constants of args shared by both input formats
+static void setOutput(transformArgs& a, const mat4x4& matWorld, const mat4x4& matView, const mat4x4& matProj,
+	float screenWidth, float screenHeight, float guardBand, transformedStream& out, size_t outFirst)
+{
+	a.worldX = out.world.x.data() + outFirst; a.worldY = out.world.y.data() + outFirst; a.worldZ = out.world.z.data() + outFirst;
+	a.viewX = out.view.x.data() + outFirst; a.viewY = out.view.y.data() + outFirst; a.viewZ = out.view.z.data() + outFirst;
+	a.screenX = out.screen.x.data() + outFirst; a.screenY = out.screen.y.data() + outFirst; a.screenZ = out.screen.z.data() + outFirst;
+	a.clipFlags = out.clipFlags.data() + outFirst;
+	a.world = &matWorld; a.view = &matView; a.proj = &matProj;
+	a.halfWidth = 0.5f * screenWidth;
+	a.halfHeight = 0.5f * screenHeight;
+	a.guardBand = effectiveGuardBand(guardBand, screenWidth, screenHeight);
+}
+
+static void runTransform(const transformArgs& a, size_t count, transformPath path) {
+	// vector kernels return how many vertices they have done, scalar kernel finishes the tail
+	size_t done = 0;
+#ifdef VERTEX_TRANSFORM_X86
+	if (path == TRANSFORM_AVX2) {
+		done = transformAVX2(a, count);
+	}
+	else if (path == TRANSFORM_SSE) {
+		done = transformSSE(a, count);
+	}
+#endif
+	transformScalar(a, done, count);
+}
+
+void transformVertices(const vertexStream& in, size_t first, size_t count,
+	const mat4x4& matWorld, const mat4x4& matView, const mat4x4& matProj,
+	float screenWidth, float screenHeight, float guardBand, transformedStream& out, size_t outFirst, transformPath path)
+{
+	if (count == 0) {
+		return;
+	}
+
+	transformArgs a;
+	a.inX = in.x.data() + first; a.inY = in.y.data() + first; a.inZ = in.z.data() + first;
+	a.packedX = nullptr; a.packedY = nullptr; a.packedZ = nullptr;
+	setOutput(a, matWorld, matView, matProj, screenWidth, screenHeight, guardBand, out, outFirst);
+	runTransform(a, count, path);
+}
+
+void transformVertices(const quantizedStream& in, size_t first, size_t count,
+	const mat4x4& matWorld, const mat4x4& matView, const mat4x4& matProj,
+	float screenWidth, float screenHeight, float guardBand, transformedStream& out, size_t outFirst, transformPath path)
+{
+	if (count == 0) {
+		return;
+	}
+
+	mat4x4 matFolded = in.dequantizeMatrix() * matWorld;
+	transformArgs a;
+	a.inX = nullptr; a.inY = nullptr; a.inZ = nullptr;
+	a.packedX = in.x.data() + first; a.packedY = in.y.data() + first; a.packedZ = in.z.data() + first;
+	setOutput(a, matFolded, matView, matProj, screenWidth, screenHeight, guardBand, out, outFirst);
+	runTransform(a, count, path);
+}
+
+void transformPositions(const vertexStream& in, size_t first, size_t count,
+	const mat4x4& matWorld, vertexStream& out, size_t outFirst)
+{
+	const float(*W)[4] = matWorld.m;
+	for (size_t i = 0; i < count; i++) {
+		float x = in.x[first + i], y = in.y[first + i], z = in.z[first + i];
+		out.x[outFirst + i] = x * W[0][0] + y * W[1][0] + z * W[2][0] + W[3][0];
+		out.y[outFirst + i] = x * W[0][1] + y * W[1][1] + z * W[2][1] + W[3][1];
+		out.z[outFirst + i] = x * W[0][2] + y * W[1][2] + z * W[2][2] + W[3][2];
+	}
+}
+
+void transformPositions(const quantizedStream& in, size_t first, size_t count,
+	const mat4x4& matWorld, vertexStream& out, size_t outFirst)
+{
+	mat4x4 matFolded = in.dequantizeMatrix() * matWorld;
+	const float(*W)[4] = matFolded.m;
+	for (size_t i = 0; i < count; i++) {
+		float x = (float)in.x[first + i], y = (float)in.y[first + i], z = (float)in.z[first + i];
+		out.x[outFirst + i] = x * W[0][0] + y * W[1][0] + z * W[2][0] + W[3][0];
+		out.y[outFirst + i] = x * W[0][1] + y * W[1][1] + z * W[2][1] + W[3][1];
+		out.z[outFirst + i] = x * W[0][2] + y * W[1][2] + z * W[2][2] + W[3][2];
+	}
+}
+
+void lightVertices(const vertexStream& normals, size_t first, size_t count,
+	const vec4& lightDir, float ambient, float* out)
+{
+	// plain loop over separate arrays, compiler vectorizes it
+	const float* nx = normals.x.data() + first;
+	const float* ny = normals.y.data() + first;
+	const float* nz = normals.z.data() + first;
+	for (size_t i = 0; i < count; i++) {
+		float light = nx[i] * lightDir.x + ny[i] * lightDir.y + nz[i] * lightDir.z;
+		out[i] = light > ambient ? light : ambient;
+	}
+}
+
+void lightVertices(const octahedralStream& normals, size_t first, size_t count,
+	const vec4& lightDir, float ambient, float* out)
+{
+	const short* nu = normals.u.data() + first;
+	const short* nv = normals.v.data() + first;
+	size_t i = 0;
+
+#ifdef VERTEX_TRANSFORM_X86
+	// 4 normals per iteration, the same arithmetic as the scalar loop below
+	const __m128 scale = _mm_set1_ps(1.0f / 32767.0f);
+	const __m128 signBit = _mm_set1_ps(-0.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 lx = _mm_set1_ps(lightDir.x), ly = _mm_set1_ps(lightDir.y), lz = _mm_set1_ps(lightDir.z);
+	const __m128 ambientLight = _mm_set1_ps(ambient);
+	const __m128i zeroCode = _mm_set1_epi32(octahedralStream::zeroNormal);
+	for (; i + 4 <= count; i += 4) {
+		// sign extend 16 bit codes into 32 bit lanes
+		__m128i qu = _mm_loadl_epi64((const __m128i*)(nu + i));
+		__m128i qv = _mm_loadl_epi64((const __m128i*)(nv + i));
+		qu = _mm_srai_epi32(_mm_unpacklo_epi16(qu, qu), 16);
+		qv = _mm_srai_epi32(_mm_unpacklo_epi16(qv, qv), 16);
+
+		__m128 x = _mm_mul_ps(_mm_cvtepi32_ps(qu), scale);
+		__m128 y = _mm_mul_ps(_mm_cvtepi32_ps(qv), scale);
+		__m128 z = _mm_sub_ps(_mm_sub_ps(one, _mm_andnot_ps(signBit, x)), _mm_andnot_ps(signBit, y));
+		__m128 fold = _mm_max_ps(_mm_sub_ps(zero, z), zero);
+		// codes never give -0, so sign of x decides direction of the fold
+		x = _mm_sub_ps(x, _mm_or_ps(fold, _mm_and_ps(x, signBit)));
+		y = _mm_sub_ps(y, _mm_or_ps(fold, _mm_and_ps(y, signBit)));
+
+		__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, lx), _mm_mul_ps(y, ly)), _mm_mul_ps(z, lz));
+		__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+		__m128 light = _mm_div_ps(dot, length);
+		__m128 isZero = _mm_castsi128_ps(_mm_and_si128(_mm_cmpeq_epi32(qu, zeroCode), _mm_cmpeq_epi32(qv, zeroCode)));
+		light = _mm_andnot_ps(isZero, light);
+		_mm_storeu_ps(out + i, _mm_max_ps(light, ambientLight));
+	}
+#endif
+
+	for (; i < count; i++) {
+		float x, y, z;
+		decodeOctahedral(nu[i], nv[i], x, y, z);
+		float light = (x * lightDir.x + y * lightDir.y + z * lightDir.z) / std::sqrt(x * x + y * y + z * z);
+		light = nu[i] == octahedralStream::zeroNormal && nv[i] == octahedralStream::zeroNormal ? 0.0f : light;
+		out[i] = light > ambient ? light : ambient;
+	}
+}
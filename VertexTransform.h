@@ -0,0 +1,163 @@
+/* Short description: structure of arrays vertex storage and batch
+ * transform of vertices from object into world, camera and screen space,
+ * with SSE / AVX2 kernels picked at runtime, quantized positions and
+ * octahedral normals are decoded on the fly
+ */
+
+#pragma once
+
+#include "vec4.h"
+#include "mat4x4.h"
+
+#include <vector>
+#include <cstddef>
+
+// vertex positions stored as separate x, y, z arrays, w is always 1
+class vertexStream
+{
+public:
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+
+	size_t size() const;
+	void resize(size_t n);
+	void clear();
+	void push_back(const vec4& v);
+
+	// single vertex as vec4 with w = 1
+	vec4 get(size_t i) const;
+};
+
+// vertex positions quantized to 16 bits per axis against their bounding box,
+// position is offset + q * scale. 6 bytes per vertex instead of 12
+class quantizedStream
+{
+public:
+	std::vector<unsigned short> x;
+	std::vector<unsigned short> y;
+	std::vector<unsigned short> z;
+	float offset[3] = { 0.0f, 0.0f, 0.0f };		// lowest position on every axis
+	float scale[3] = { 0.0f, 0.0f, 0.0f };		// size of one quantization step
+
+	size_t size() const;
+	void clear();
+
+	// quantize positions, their bounding box is spread over the whole 16 bit range
+	void encode(const vertexStream& in);
+
+	// single dequantized vertex as vec4 with w = 1
+	vec4 get(size_t i) const;
+
+	// quantized -> object space transform, kernels fold it into the world matrix
+	mat4x4 dequantizeMatrix() const;
+};
+
+// unit normals in octahedral encoding, 2 signed 16 bit values per normal instead
+// of 3 floats. Zero normals (vertices without light) get code zeroNormal
+class octahedralStream
+{
+public:
+	static const short zeroNormal = -32768;
+
+	std::vector<short> u;
+	std::vector<short> v;
+
+	size_t size() const;
+	void clear();
+
+	// encode normals, every one has to be of unit or zero length
+	void encode(const vertexStream& in);
+
+	// single decoded normal, of unit length
+	vec4 get(size_t i) const;
+};
+
+// position of vertex against planes of homogeneous clip space (x, y, z, w),
+// visible volume is -w <= x <= w, -w <= y <= w, 0 <= z <= w
+enum clipFlag
+{
+	CLIP_NEAR = 1,			// z < 0
+	CLIP_FAR = 2,			// z > w
+	CLIP_LEFT = 4,			// x < -w
+	CLIP_RIGHT = 8,			// x > w
+	CLIP_BOTTOM = 16,		// y < -w
+	CLIP_TOP = 32,			// y > w
+	CLIP_GUARD_X = 64,		// |x| > guardBand * w
+	CLIP_GUARD_Y = 128,		// |y| > guardBand * w
+
+	// polygon is outside if all its vertices share one of these
+	CLIP_OUTSIDE_VIEW = CLIP_NEAR | CLIP_FAR | CLIP_LEFT | CLIP_RIGHT | CLIP_BOTTOM | CLIP_TOP,
+	// polygon has to be clipped if any of its vertices has one of these
+	CLIP_NEEDED = CLIP_NEAR | CLIP_FAR | CLIP_GUARD_X | CLIP_GUARD_Y
+};
+
+// largest width and height in pixels of triangle the rasterizer draws, see rasterTriangle
+const int maxRasterSize = 16384;
+
+// guard band lowered so polygons inside of it span at most maxRasterSize pixels
+// (less one pixel for snapping) on screen of given size, but never inside of screen.
+// Transform and clipper have to use the same value
+float effectiveGuardBand(float guardBand, float screenWidth, float screenHeight);
+
+// results of batch transform, index of vertex is the same in every stream
+class transformedStream
+{
+public:
+	vertexStream world;		// after world transform
+	vertexStream view;		// after world and camera transform
+	vertexStream screen;	// in pixels, valid only for vertices without CLIP_NEAR
+	std::vector<unsigned char> clipFlags;	// combination of clipFlag values
+
+	void resize(size_t n);
+};
+
+// available kernels, from slowest to fastest
+enum transformPath
+{
+	TRANSFORM_SCALAR,
+	TRANSFORM_SSE,
+	TRANSFORM_AVX2
+};
+
+// fastest kernel supported by the running CPU, detected once
+transformPath bestTransformPath();
+
+// kernel name for logs
+const char* transformPathName(transformPath path);
+
+// only world transform of vertices [first, first + count), with the same arithmetic
+// as transformVertices, vertex first + i is written at outFirst + i
+void transformPositions(const vertexStream& in, size_t first, size_t count,
+	const mat4x4& matWorld, vertexStream& out, size_t outFirst);
+
+// the same for quantized positions, dequantization is folded into matWorld
+void transformPositions(const quantizedStream& in, size_t first, size_t count,
+	const mat4x4& matWorld, vertexStream& out, size_t outFirst);
+
+// diffuse light of vertices [first, first + count) from their unit normals,
+// max(ambient, dot(normal, lightDir)), light direction has to be in the same space
+// as normals, vertex first + i is written at out[i]
+void lightVertices(const vertexStream& normals, size_t first, size_t count,
+	const vec4& lightDir, float ambient, float* out);
+
+// the same for octahedral normals, they are decoded in the same loop
+void lightVertices(const octahedralStream& normals, size_t first, size_t count,
+	const vec4& lightDir, float ambient, float* out);
+
+// transform vertices [first, first + count) of given stream in one pass:
+// world and view transforms (both expected affine), projection, clip flags
+// against frustum and guard band, perspective divide and viewport scaling
+// to screenWidth x screenHeight pixels. Guard band is limited by effectiveGuardBand.
+// Vertex first + i is written at outFirst + i, out has to be sized by caller
+void transformVertices(const vertexStream& in, size_t first, size_t count,
+	const mat4x4& matWorld, const mat4x4& matView, const mat4x4& matProj,
+	float screenWidth, float screenHeight, float guardBand, transformedStream& out, size_t outFirst,
+	transformPath path = bestTransformPath());
+
+// the same for quantized positions, 16 bit values are converted to float in vector
+// registers and dequantization is folded into the world matrix
+void transformVertices(const quantizedStream& in, size_t first, size_t count,
+	const mat4x4& matWorld, const mat4x4& matView, const mat4x4& matProj,
+	float screenWidth, float screenHeight, float guardBand, transformedStream& out, size_t outFirst,
+	transformPath path = bestTransformPath());
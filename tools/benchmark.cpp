@@ -0,0 +1,211 @@
+/* Short description: headless benchmark, renders objects along fixed
+ * camera path and prints timings of render stages as JSON,
+ * usage: benchmark [-frames N] [-threads N] [-instances N] [-sort] [-still] [-pipelined] [-no-occlusion] [-no-vertex-cache] [-compact] [-trace out.json] [files.obj...]
+ */
+
+#include "../RenderEngine.h"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+// camera flies one circle around the object, closing in at half way
+// so that clipping is exercised as well, object rotates one turn unless still
+static void cameraPath(RenderEngine& engine, int frame, int frames, bool still) {
+	const float pi = 3.14159265f;
+	float t = (float)frame / (float)frames;
+	float angle = 2.0f * pi * t;
+	float radius = 13.0f - 10.0f * sinf(pi * t) * sinf(pi * t);
+
+	// objects are moved to (0, 0, 5) by world transform
+	vec4 center = { 0.0f, 0.5f, 5.0f };
+	engine.vCamera = vec4(center.x + radius * sinf(angle), 1.0f, center.z - radius * cosf(angle));
+
+	// look direction is rotation of (0, 0, 1) around y: (-sin(yaw), 0, cos(yaw))
+	engine.fYaw = atan2f(-(center.x - engine.vCamera.x), center.z - engine.vCamera.z);
+	engine.fTheta = still ? 0.0f : angle;
+}
+
+// replace the only instance of loaded object with square grid of count copies
+// in horizontal plane, centered where the object was
+static void makeGrid(RenderEngine& engine, int count) {
+	scene& s = engine.objectScene;
+	const bvhNode& root = s.assets[0]->levels[0].hierarchy.nodes[0];
+	float spacing = 1.5f * std::max(root.boundsMax[0] - root.boundsMin[0], root.boundsMax[2] - root.boundsMin[2]);
+	int side = (int)std::ceil(std::sqrt((float)count));
+
+	s.instances.clear();
+	for (int i = 0; i < count; i++) {
+		float x = ((i % side) - (side - 1) * 0.5f) * spacing;
+		float z = ((i / side) - (side - 1) * 0.5f) * spacing;
+		s.addInstance(0, mat4x4::makeTranslation(x, 0.0f, 5.0f + z));
+	}
+}
+
+static void printStats(const char* name, const sampleStats& stats, bool last) {
+	std::cout << "        \"" << name << "\": { \"mean_ms\": " << stats.mean()
+		<< ", \"p50_ms\": " << stats.percentile(50.0)
+		<< ", \"p99_ms\": " << stats.percentile(99.0)
+		<< ", \"max_ms\": " << stats.max() << " }" << (last ? "" : ",") << std::endl;
+}
+
+int main(int argc, char** argv) {
+	int frames = 200;
+	int threads = 0;
+	int instances = 1;
+	bool sort = false;
+	bool still = false;
+	bool pipelined = false;
+	bool occlusion = true;
+	bool vertexCache = true;
+	bool compact = false;
+	std::string traceFile;
+	std::vector<std::string> files;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-frames") && i + 1 < argc) {
+			frames = std::max(1, atoi(argv[++i]));
+		}
+		else if (!strcmp(argv[i], "-threads") && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-instances") && i + 1 < argc) {
+			instances = std::max(1, atoi(argv[++i]));
+		}
+		else if (!strcmp(argv[i], "-sort")) {
+			sort = true;
+		}
+		else if (!strcmp(argv[i], "-still")) {
+			still = true;
+		}
+		else if (!strcmp(argv[i], "-pipelined")) {
+			pipelined = true;
+		}
+		else if (!strcmp(argv[i], "-no-occlusion")) {
+			occlusion = false;
+		}
+		else if (!strcmp(argv[i], "-no-vertex-cache")) {
+			vertexCache = false;
+		}
+		else if (!strcmp(argv[i], "-compact")) {
+			compact = true;
+		}
+		else if (!strcmp(argv[i], "-trace") && i + 1 < argc) {
+			traceFile = argv[++i];
+		}
+		else if (argv[i][0] == '-') {
+			std::cout << "Usage: benchmark [-frames N] [-threads N] [-instances N] [-sort] [-still] [-pipelined] [-no-occlusion] [-no-vertex-cache] [-compact] [-trace out.json] [files.obj...]" << std::endl;
+			return 1;
+		}
+		else {
+			files.push_back(argv[i]);
+		}
+	}
+	if (files.empty()) {
+		files = { "objects/teapot.obj", "objects/sphere.obj", "objects/cube.obj" };
+	}
+
+	std::cout << std::fixed << std::setprecision(4);
+	std::cout << "{" << std::endl;
+	std::cout << "  \"frames\": " << frames << "," << std::endl;
+	std::cout << "  \"objects\": [" << std::endl;
+
+	for (size_t f = 0; f < files.size(); f++) {
+		RenderEngine engine(true);
+		engine.threadCount = threads;
+		engine.depthSort = sort;
+		engine.occlusionCulling = occlusion;
+		engine.objectScene.vertexCacheOrder = vertexCache;
+		engine.objectScene.compactMeshes = compact;
+		if (!engine.load(files[f])) {
+			std::cerr << "Error openning file " << files[f] << std::endl;
+			return 1;
+		}
+		if (instances > 1 && !engine.objectScene.assets[0]->levels[0].hierarchy.nodes.empty()) {
+			makeGrid(engine, instances);
+		}
+		const mesh& objectMesh = engine.objectScene.assets[0]->levels[0].geometry;
+		const bvh& objectHierarchy = engine.objectScene.assets[0]->levels[0].hierarchy;
+
+		// pipelined frame time is time between drawn frames, geometry of next one overlaps it
+		sampleStats stages[STAGE_COUNT];
+		sampleStats frameTimes;
+		size_t arenaPeak = 0;
+		size_t worldCachePeak = 0;
+		sampleStats occluded;
+		auto runStart = std::chrono::steady_clock::now();
+		if (pipelined) {
+			engine.startPipeline();
+			cameraPath(engine, 0, frames, still);
+			engine.queueFrame();
+		}
+		for (int i = 0; i < frames; i++) {
+			auto start = std::chrono::steady_clock::now();
+			if (pipelined) {
+				if (i + 1 < frames) {
+					cameraPath(engine, i + 1, frames, still);
+					engine.queueFrame();
+				}
+				engine.drawQueuedFrame();
+			}
+			else {
+				cameraPath(engine, i, frames, still);
+				engine.render(0.0f);
+			}
+			frameTimes.add(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+			for (int s = 0; s < STAGE_COUNT; s++) {
+				stages[s].add(engine.lastFrame.ms[s]);
+			}
+			arenaPeak = std::max(arenaPeak, engine.lastFrame.arenaBytes);
+			worldCachePeak = std::max(worldCachePeak, engine.lastFrame.worldCacheBytes);
+			occluded.add((double)engine.lastFrame.occludedLeaves);
+		}
+
+		engine.stopPipeline();
+		double runSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+
+		std::cout << "    {" << std::endl;
+		std::cout << "      \"file\": \"" << files[f] << "\"," << std::endl;
+		std::cout << "      \"polygons\": " << objectMesh.polyCount() << "," << std::endl;
+		std::cout << "      \"instances\": " << engine.objectScene.instances.size() << "," << std::endl;
+		std::cout << "      \"vertices\": " << objectMesh.vertexCount() << "," << std::endl;
+		std::cout << "      \"threads\": " << engine.threadPool.size() << "," << std::endl;
+		std::cout << "      \"load_ms\": " << objectMesh.lastLoad.seconds * 1000.0 << "," << std::endl;
+		std::cout << "      \"acmr_file\": " << objectHierarchy.acmrFile << "," << std::endl;
+		std::cout << "      \"acmr_before\": " << objectHierarchy.acmrBefore << "," << std::endl;
+		std::cout << "      \"acmr_after\": " << objectHierarchy.acmrAfter << "," << std::endl;
+		size_t meshBytes = 0;
+		for (const meshLod& level : engine.objectScene.assets[0]->levels) {
+			meshBytes += level.geometry.memoryBytes();
+		}
+		std::cout << "      \"mesh_bytes\": " << meshBytes << "," << std::endl;
+		std::cout << "      \"world_cache_bytes\": " << worldCachePeak << "," << std::endl;
+		std::cout << "      \"load_from_cache\": " << (objectMesh.lastLoad.fromCache ? "true" : "false") << "," << std::endl;
+		std::cout << "      \"pipelined\": " << (pipelined ? "true" : "false") << "," << std::endl;
+		std::cout << "      \"fps\": " << frames / runSeconds << "," << std::endl;
+		std::cout << "      \"arena_peak_bytes\": " << arenaPeak << "," << std::endl;
+		std::cout << "      \"occluded_clusters\": " << occluded.mean() << "," << std::endl;
+		std::cout << "      \"stages\": {" << std::endl;
+		for (int s = 0; s < STAGE_COUNT; s++) {
+			printStats(renderStageName((renderStage)s), stages[s], false);
+		}
+		printStats("frame", frameTimes, true);
+		std::cout << "      }" << std::endl;
+		std::cout << "    }" << (f + 1 < files.size() ? "," : "") << std::endl;
+	}
+
+	std::cout << "  ]" << std::endl;
+	std::cout << "}" << std::endl;
+
+	// zones of all rendered frames, older ones are dropped when rings are full
+	if (!traceFile.empty() && !Profiler::writeChromeTrace(traceFile)) {
+		std::cerr << "Error writing file " << traceFile << std::endl;
+		return 1;
+	}
+	return 0;
+}
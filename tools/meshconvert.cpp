@@ -0,0 +1,40 @@
+/* Short description: converts obj files into binary mesh format,
+ * usage: meshconvert input.obj [output.rmesh]
+ */
+
+#include "../Scene.h"
+#include "../MeshCache.h"
+
+#include <iostream>
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::cout << "Usage: meshconvert input.obj [output.rmesh]" << std::endl;
+		return 1;
+	}
+
+	std::string input = argv[1];
+	std::string output = argc > 2 ? argv[2] : meshCachePath(input);
+
+	// the same levels and hierarchies as engine builds with default options
+	scene converter;
+	if (converter.loadAsset(input, false) < 0) {
+		std::cout << "Error openning file " << input << std::endl;
+		return 1;
+	}
+	const meshAsset& asset = *converter.assets[0];
+
+	// written output is valid as cache of the input file as well
+	uint64_t sourceSize = 0;
+	int64_t sourceMtime = 0;
+	sourceFileInfo(input, sourceSize, sourceMtime);
+	if (!saveMeshCache(asset, converter.cacheOptions(), output, sourceSize, sourceMtime)) {
+		std::cout << "Error writing file " << output << std::endl;
+		return 1;
+	}
+
+	const mesh& m = asset.levels[0].geometry;
+	std::cout << input << " -> " << output << ": " << m.verts.size() << " vertices, "
+		<< m.polyCount() << " polygons" << std::endl;
+	return 0;
+}